@@ -0,0 +1,590 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mc/triangle_consumer.hpp>
+#include <mc/util/simd.hpp>
+#include <mc/volume.hpp>
+
+#include "demos/hello_mc/demos.hpp"
+#include "demos/terrain/terrain_sources.hpp"
+
+using namespace glm;
+using mc::util::unowned_ptr;
+
+/*
+ mc_bench marches the hello_mc demo scenes and a terrain chunk headlessly
+ (no window or GL context) at several volume sizes and thread counts, and
+ reports per-phase timings and throughput. Throughput figures are computed
+ over the combined mark, collect and march time. Usage:
+    mc_bench [--json] [--sizes 32,64,128] [--threads 1,4] [--iterations 5] [--scene Name] [--surface-nets]
+        [--seed-spacing N] [--smooth-normals] [--shared-consumer] [--classify] [--check-seams]
+ --surface-nets extracts with Naive Surface Nets rather than marching cubes.
+ --seed-spacing tracks the surface, probing for it every N cells (see MarchOptions::seedSpacing).
+ --smooth-normals computes vertex normals from the field's gradient (see MarchOptions::smoothNormals).
+ --shared-consumer marches every thread into a single TriangleConsumer, rather than one per thread.
+ --classify rather than marching, times finding the cells each scene's surface crosses over a
+    pre-sampled lattice, per cell as a GridCell, and a row at a time from Slab::classify()'s bits.
+ --check-seams rather than benchmarking, marches a sphere with smooth normals into a region whose
+    faces are stitched to coarser neighbors, and fails unless the vertices on those faces keep
+    normals within kSeamNormalTolerance degrees of the field's gradient.
+ */
+
+namespace {
+
+// fuzziness used by the hello_mc & terrain demos respectively
+constexpr float kDemoFuzziness = 1.0F;
+constexpr float kTerrainFuzziness = 2.0F;
+constexpr int kMinNodeSize = 4;
+
+// terrain parameters from the terrain demo
+constexpr int kTerrainChunkSize = 128;
+constexpr float kTerrainHeight = 32.0F;
+
+// degrees a smooth normal on a stitched face may stray from the field's gradient
+constexpr float kSeamNormalTolerance = 5.0F;
+
+struct Options {
+    bool json = false;
+    std::vector<int> sizes { 32, 64, 128 };
+    std::vector<int> threads;
+    int iterations = 5;
+    std::string scene;
+    mc::Extractor extractor = mc::Extractor::MarchingCubes;
+    int seedSpacing = 0;
+    bool smoothNormals = false;
+    bool sharedConsumer = false;
+    bool classify = false;
+    bool checkSeams = false;
+};
+
+struct Scene {
+    std::string name;
+    float fuzziness;
+    // populate the volume; the returned object (if any) is kept alive while the volume is marched
+    std::function<std::shared_ptr<void>(mc::OctreeVolume&)> build;
+};
+
+struct ClassifyResult {
+    std::string scene;
+    int size = 0;
+    std::size_t cells = 0;
+    std::size_t activeCells = 0;
+    double gridCellSeconds = 0;
+    double bitRowSeconds = 0;
+};
+
+struct SeamResult {
+    int stride = 0;
+    bool indexed = false;
+    std::size_t vertices = 0;
+    double meanDegrees = 0;
+    double maxDegrees = 0;
+};
+
+struct Result {
+    std::string scene;
+    int size = 0;
+    int threads = 0;
+    int iterations = 0;
+    std::size_t triangles = 0;
+    mc::OctreeVolume::MarchStats stats;
+    double totalSeconds = 0;
+};
+
+std::vector<int> parseList(const std::string& str)
+{
+    std::vector<int> values;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        values.push_back(std::stoi(item));
+    }
+    return values;
+}
+
+Options parseOptions(int argc, const char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const auto needsValue = [&]() -> std::string {
+            if (i + 1 >= argc) {
+                throw std::runtime_error(std::string("Missing value for ") + argv[i]);
+            }
+            return argv[++i];
+        };
+
+        if (!strcmp(argv[i], "--json")) {
+            options.json = true;
+        } else if (!strcmp(argv[i], "--sizes")) {
+            options.sizes = parseList(needsValue());
+        } else if (!strcmp(argv[i], "--threads")) {
+            options.threads = parseList(needsValue());
+        } else if (!strcmp(argv[i], "--iterations")) {
+            options.iterations = std::max(std::stoi(needsValue()), 1);
+        } else if (!strcmp(argv[i], "--scene")) {
+            options.scene = needsValue();
+        } else if (!strcmp(argv[i], "--surface-nets")) {
+            options.extractor = mc::Extractor::SurfaceNets;
+        } else if (!strcmp(argv[i], "--seed-spacing")) {
+            options.seedSpacing = std::max(std::stoi(needsValue()), 0);
+        } else if (!strcmp(argv[i], "--smooth-normals")) {
+            options.smoothNormals = true;
+        } else if (!strcmp(argv[i], "--shared-consumer")) {
+            options.sharedConsumer = true;
+        } else if (!strcmp(argv[i], "--classify")) {
+            options.classify = true;
+        } else if (!strcmp(argv[i], "--check-seams")) {
+            options.checkSeams = true;
+        } else {
+            throw std::runtime_error(std::string("Unrecognized argument: ") + argv[i]);
+        }
+    }
+
+    if (options.threads.empty()) {
+        const int hw = std::max<int>(std::thread::hardware_concurrency(), 1);
+        options.threads = { 1 };
+        if (hw > 1) {
+            options.threads.push_back(hw);
+        }
+    }
+
+    return options;
+}
+
+std::vector<Scene> makeScenes()
+{
+    std::vector<Scene> scenes;
+    for (const auto& entry : DemoRegistry) {
+        const auto factory = entry.second;
+        scenes.push_back(Scene { entry.first, kDemoFuzziness, [factory](mc::OctreeVolume& volume) {
+                                    auto demo = std::shared_ptr<Demo>(factory());
+                                    demo->build(&volume);
+                                    demo->step(0);
+                                    return std::static_pointer_cast<void>(demo);
+                                } });
+    }
+
+    // a terrain chunk at the origin, with greebling, as built by TerrainGrid
+    scenes.push_back(Scene { "Terrain", kTerrainFuzziness, [](mc::OctreeVolume& volume) {
+                                struct TerrainState {
+                                    FastNoise noise;
+                                    std::unique_ptr<LumpyTerrainSource> terrain;
+                                    std::unique_ptr<Greebler> greebler;
+                                };
+
+                                auto state = std::make_shared<TerrainState>();
+                                state->noise.SetNoiseType(FastNoise::Simplex);
+                                state->noise.SetFrequency(1.0F / kTerrainChunkSize);
+                                state->noise.SetFractalOctaves(3);
+                                state->terrain = std::make_unique<LumpyTerrainSource>(state->noise, kTerrainHeight);
+                                state->greebler = std::make_unique<Greebler>(state->noise);
+
+                                const auto size = vec3(volume.getSize());
+                                volume.add(std::make_unique<TerrainSampler>(state->terrain.get(), vec3(0)));
+                                state->greebler->addGreebles(mc::util::AABB(vec3(0), size), volume);
+                                return std::static_pointer_cast<void>(state);
+                            } });
+
+    return scenes;
+}
+
+Result run(const Scene& scene, int size, int numThreads, const Options& options)
+{
+    mc::util::ThreadPool threadPool(numThreads, false);
+    std::vector<std::unique_ptr<mc::TriangleConsumer<mc::Vertex>>> triangleConsumers;
+    std::vector<unowned_ptr<mc::TriangleConsumer<mc::Vertex>>> unownedTriangleConsumers;
+    for (int i = 0, N = options.sharedConsumer ? 1 : numThreads; i < N; i++) {
+        triangleConsumers.push_back(std::make_unique<mc::TriangleConsumer<mc::Vertex>>());
+        unownedTriangleConsumers.push_back(triangleConsumers.back().get());
+    }
+
+    auto volume = options.sharedConsumer
+        ? std::make_unique<mc::OctreeVolume>(size, scene.fuzziness, kMinNodeSize, &threadPool, unownedTriangleConsumers.front())
+        : std::make_unique<mc::OctreeVolume>(size, scene.fuzziness, kMinNodeSize, &threadPool, unownedTriangleConsumers);
+    mc::MarchOptions marchOptions;
+    marchOptions.seedSpacing = options.seedSpacing;
+    marchOptions.smoothNormals = options.smoothNormals;
+    volume->setMarchOptions(marchOptions);
+    volume->setExtractor(options.extractor);
+    const auto sceneState = scene.build(*volume);
+
+    // warm up caches & the allocator
+    volume->march();
+
+    Result result;
+    result.scene = scene.name;
+    result.size = size;
+    result.threads = numThreads;
+    result.iterations = options.iterations;
+
+    for (int i = 0; i < options.iterations; i++) {
+        volume->march();
+        const auto& stats = volume->getLastMarchStats();
+        result.stats.markSeconds += stats.markSeconds;
+        result.stats.collectSeconds += stats.collectSeconds;
+        result.stats.marchSeconds += stats.marchSeconds;
+        result.stats.nodesMarched = stats.nodesMarched;
+        result.stats.voxels = stats.voxels;
+        result.stats.samplerEvaluations = stats.samplerEvaluations;
+    }
+
+    result.stats.markSeconds /= options.iterations;
+    result.stats.collectSeconds /= options.iterations;
+    result.stats.marchSeconds /= options.iterations;
+    result.totalSeconds = result.stats.markSeconds + result.stats.collectSeconds + result.stats.marchSeconds;
+
+    for (const auto& tc : triangleConsumers) {
+        result.triangles += tc->getNumTriangles();
+    }
+
+    return result;
+}
+
+/*
+ Time finding the cells the surface crosses over the lattice of a whole volume, sampled
+ up front so only classification is timed: per cell, assembling a GridCell and testing
+ its cube index, and a row at a time from the corner bits Slab::classify() packs, as
+ march() does. Both count the same cells.
+ */
+ClassifyResult classify(const Scene& scene, int size, const Options& options)
+{
+    using Clock = std::chrono::steady_clock;
+    constexpr float IsoLevel = 0.5F;
+
+    mc::util::ThreadPool threadPool(1, false);
+    mc::TriangleConsumer<mc::Vertex> triangleConsumer;
+    mc::OctreeVolume volume(size, scene.fuzziness, kMinNodeSize, &threadPool,
+        std::vector<unowned_ptr<mc::TriangleConsumer<mc::Vertex>>> { &triangleConsumer });
+    const auto sceneState = scene.build(volume);
+
+    // marking hands the root node every sampler intersecting the volume
+    volume.march();
+    mc::OctreeVolume::Node* root = nullptr;
+    volume.walkOctree([&root](mc::OctreeVolume::Node* node) {
+        root = node;
+        return false;
+    });
+
+    const float fuzziness = volume.getFuzziness();
+    const auto sampler = [root, fuzziness](const vec3& p, mc::MaterialState& material) {
+        return root->valueAt(p, fuzziness, material, false);
+    };
+
+    const mc::detail::Lattice lattice(mc::util::iAABB(ivec3(0), ivec3(size)), 1);
+    const auto cells = lattice.cells();
+    std::vector<std::unique_ptr<mc::detail::Slab>> slabs;
+    for (int k = 0; k <= cells.z; k++) {
+        slabs.push_back(std::make_unique<mc::detail::Slab>());
+        slabs.back()->sample(lattice, lattice.z(k), sampler);
+    }
+
+    ClassifyResult result;
+    result.scene = scene.name;
+    result.size = size;
+    result.cells = static_cast<std::size_t>(cells.x) * cells.y * cells.z;
+
+    std::size_t gridCellActive = 0;
+    mc::detail::GridCell cell;
+    auto start = Clock::now();
+    for (int i = 0; i < options.iterations; i++) {
+        gridCellActive = 0;
+        for (int z = 0; z < cells.z; z++) {
+            for (int y = 0; y < cells.y; y++) {
+                for (int x = 0; x < cells.x; x++) {
+                    mc::detail::GetGridCell(x, y, z, lattice, *slabs[z], *slabs[z + 1], cell);
+                    gridCellActive += mc::detail::kEdgeTable[mc::detail::CubeIndex(cell, IsoLevel)] != 0;
+                }
+            }
+        }
+    }
+    result.gridCellSeconds = std::chrono::duration<double>(Clock::now() - start).count() / options.iterations;
+
+    std::vector<int> active;
+    start = Clock::now();
+    for (int i = 0; i < options.iterations; i++) {
+        result.activeCells = 0;
+        slabs[0]->classify(IsoLevel);
+        for (int z = 0; z < cells.z; z++) {
+            slabs[z + 1]->classify(IsoLevel);
+            for (int y = 0; y < cells.y; y++) {
+                mc::detail::ActiveCells(lattice, y, *slabs[z], *slabs[z + 1], active);
+                result.activeCells += active.size();
+            }
+        }
+    }
+    result.bitRowSeconds = std::chrono::duration<double>(Clock::now() - start).count() / options.iterations;
+
+    if (gridCellActive != result.activeCells) {
+        throw std::runtime_error("classify: " + scene.name + " per cell and bit row active cell counts differ");
+    }
+
+    return result;
+}
+
+void printClassify(const Options& options, const std::vector<ClassifyResult>& results)
+{
+    if (options.json) {
+        std::cout << std::setprecision(9);
+        std::cout << "{\n";
+        std::cout << "  \"benchmark\": \"mc_bench_classify\",\n";
+        std::cout << "  \"simd_width\": " << mc::util::simd::floatv::width << ",\n";
+        std::cout << "  \"iterations\": " << options.iterations << ",\n";
+        std::cout << "  \"results\": [";
+        for (std::size_t i = 0; i < results.size(); i++) {
+            const auto& r = results[i];
+            std::cout << (i ? ",\n" : "\n") << "    {"
+                      << "\"scene\": \"" << r.scene << "\", "
+                      << "\"size\": " << r.size << ", "
+                      << "\"cells\": " << r.cells << ", "
+                      << "\"active_cells\": " << r.activeCells << ", "
+                      << "\"grid_cell_seconds\": " << r.gridCellSeconds << ", "
+                      << "\"bit_row_seconds\": " << r.bitRowSeconds
+                      << "}";
+        }
+        std::cout << "\n  ]\n}" << std::endl;
+        return;
+    }
+
+    std::cout << std::left << std::setw(22) << "scene"
+              << std::right << std::setw(6) << "size"
+              << std::setw(12) << "active"
+              << std::setw(14) << "gridcell ms"
+              << std::setw(12) << "bit row ms"
+              << std::setw(10) << "speedup"
+              << std::endl;
+
+    std::cout << std::fixed;
+    for (const auto& r : results) {
+        std::cout << std::left << std::setw(22) << r.scene
+                  << std::right << std::setw(6) << r.size
+                  << std::setw(12) << r.activeCells
+                  << std::setprecision(3)
+                  << std::setw(14) << r.gridCellSeconds * 1e3
+                  << std::setw(12) << r.bitRowSeconds * 1e3
+                  << std::setprecision(2)
+                  << std::setw(10) << (r.bitRowSeconds > 0 ? r.gridCellSeconds / r.bitRowSeconds : 0)
+                  << std::endl;
+    }
+}
+
+/*
+ March a sphere with smooth normals into a region whose faces are all stitched to neighbors
+ at twice its stride, and measure how far the normals of the vertices TransitionFaces
+ snapped onto those faces stray from the field's gradient.
+ */
+SeamResult checkSeams(int stride, bool indexed, const Options& options)
+{
+    const vec3 center(16.3F, 13.7F, 17.1F);
+    const float radius = 12.5F;
+    // values rise into the sphere, without clamping, so the outward normal is exactly radial
+    const auto sampler = [center, radius](const vec3& p, mc::MaterialState&) {
+        return 0.5F + (radius - distance(p, center)) * 0.25F;
+    };
+
+    mc::MarchOptions marchOptions;
+    marchOptions.stride = stride;
+    marchOptions.seedSpacing = options.seedSpacing;
+    marchOptions.smoothNormals = true;
+    for (auto& neighborStride : marchOptions.neighborStrides) {
+        neighborStride = stride * 2;
+    }
+
+    // the region cuts through the sphere on every face
+    const mc::util::iAABB region(ivec3(4), ivec3(28));
+    std::vector<mc::Vertex> vertices;
+    if (indexed) {
+        mc::IndexedTriangleConsumer<mc::Vertex> triangleConsumer;
+        triangleConsumer.start();
+        mc::march(region, sampler, triangleConsumer, marchOptions);
+        vertices = triangleConsumer.getVertices();
+    } else {
+        mc::TriangleConsumer<mc::Vertex> triangleConsumer;
+        triangleConsumer.start();
+        mc::march(region, sampler, triangleConsumer, marchOptions);
+        vertices = triangleConsumer.getVertices();
+    }
+
+    SeamResult result;
+    result.stride = stride;
+    result.indexed = indexed;
+    for (const auto& v : vertices) {
+        bool onFace = false;
+        for (int axis = 0; axis < 3; axis++) {
+            onFace = onFace || std::abs(v.pos[axis] - region.min[axis]) < 1e-4F || std::abs(v.pos[axis] - region.max[axis]) < 1e-4F;
+        }
+        if (onFace) {
+            const float cosine = clamp(dot(normalize(v.triangleNormal), normalize(v.pos - center)), -1.0F, 1.0F);
+            const double degrees = std::acos(cosine) * 180.0 / pi<double>();
+            result.vertices++;
+            result.meanDegrees += degrees;
+            result.maxDegrees = std::max(result.maxDegrees, degrees);
+        }
+    }
+    if (result.vertices) {
+        result.meanDegrees /= result.vertices;
+    }
+
+    return result;
+}
+
+void printSeams(const std::vector<SeamResult>& results)
+{
+    std::cout << std::right << std::setw(6) << "stride"
+              << std::setw(10) << "path"
+              << std::setw(10) << "vertices"
+              << std::setw(12) << "mean deg"
+              << std::setw(12) << "max deg"
+              << std::endl;
+
+    std::cout << std::fixed << std::setprecision(3);
+    for (const auto& r : results) {
+        std::cout << std::setw(6) << r.stride
+                  << std::setw(10) << (r.indexed ? "indexed" : "triangles")
+                  << std::setw(10) << r.vertices
+                  << std::setw(12) << r.meanDegrees
+                  << std::setw(12) << r.maxDegrees
+                  << std::endl;
+    }
+}
+
+double perSecond(double count, double seconds)
+{
+    return seconds > 0 ? count / seconds : 0;
+}
+
+void printTable(const std::vector<Result>& results)
+{
+    std::cout << std::left << std::setw(22) << "scene"
+              << std::right << std::setw(6) << "size"
+              << std::setw(8) << "threads"
+              << std::setw(10) << "tris"
+              << std::setw(11) << "mark ms"
+              << std::setw(11) << "collect ms"
+              << std::setw(11) << "march ms"
+              << std::setw(14) << "Mvoxels/s"
+              << std::setw(14) << "Msamples/s"
+              << std::setw(14) << "Mtris/s"
+              << std::endl;
+
+    std::cout << std::fixed;
+    for (const auto& r : results) {
+        std::cout << std::left << std::setw(22) << r.scene
+                  << std::right << std::setw(6) << r.size
+                  << std::setw(8) << r.threads
+                  << std::setw(10) << r.triangles
+                  << std::setprecision(3)
+                  << std::setw(11) << r.stats.markSeconds * 1e3
+                  << std::setw(11) << r.stats.collectSeconds * 1e3
+                  << std::setw(11) << r.stats.marchSeconds * 1e3
+                  << std::setw(14) << perSecond(r.stats.voxels, r.totalSeconds) * 1e-6
+                  << std::setw(14) << perSecond(r.stats.samplerEvaluations, r.totalSeconds) * 1e-6
+                  << std::setw(14) << perSecond(r.triangles, r.totalSeconds) * 1e-6
+                  << std::endl;
+    }
+}
+
+void printJson(const Options& options, const std::vector<Result>& results)
+{
+    std::cout << std::setprecision(9);
+    std::cout << "{\n";
+    std::cout << "  \"benchmark\": \"mc_bench\",\n";
+    std::cout << "  \"simd_width\": " << mc::util::simd::floatv::width << ",\n";
+    std::cout << "  \"iterations\": " << options.iterations << ",\n";
+    std::cout << "  \"extractor\": \"" << (options.extractor == mc::Extractor::SurfaceNets ? "surface_nets" : "marching_cubes") << "\",\n";
+    std::cout << "  \"seed_spacing\": " << options.seedSpacing << ",\n";
+    std::cout << "  \"smooth_normals\": " << (options.smoothNormals ? "true" : "false") << ",\n";
+    std::cout << "  \"shared_consumer\": " << (options.sharedConsumer ? "true" : "false") << ",\n";
+    std::cout << "  \"results\": [";
+    for (std::size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        std::cout << (i ? ",\n" : "\n") << "    {"
+                  << "\"scene\": \"" << r.scene << "\", "
+                  << "\"size\": " << r.size << ", "
+                  << "\"threads\": " << r.threads << ", "
+                  << "\"nodes_marched\": " << r.stats.nodesMarched << ", "
+                  << "\"voxels\": " << r.stats.voxels << ", "
+                  << "\"sampler_evaluations\": " << r.stats.samplerEvaluations << ", "
+                  << "\"triangles\": " << r.triangles << ", "
+                  << "\"mark_seconds\": " << r.stats.markSeconds << ", "
+                  << "\"collect_seconds\": " << r.stats.collectSeconds << ", "
+                  << "\"march_seconds\": " << r.stats.marchSeconds << ", "
+                  << "\"total_seconds\": " << r.totalSeconds << ", "
+                  << "\"voxels_per_second\": " << perSecond(r.stats.voxels, r.totalSeconds) << ", "
+                  << "\"sampler_evaluations_per_second\": " << perSecond(r.stats.samplerEvaluations, r.totalSeconds) << ", "
+                  << "\"triangles_per_second\": " << perSecond(r.triangles, r.totalSeconds)
+                  << "}";
+    }
+    std::cout << "\n  ]\n}" << std::endl;
+}
+
+}
+
+int main(int argc, const char* argv[])
+{
+    try {
+        const auto options = parseOptions(argc, argv);
+
+        if (options.classify) {
+            std::vector<ClassifyResult> results;
+            for (const auto& scene : makeScenes()) {
+                if (options.scene.empty() || options.scene == scene.name) {
+                    for (auto size : options.sizes) {
+                        results.push_back(classify(scene, size, options));
+                    }
+                }
+            }
+            printClassify(options, results);
+            return EXIT_SUCCESS;
+        }
+
+        if (options.checkSeams) {
+            std::vector<SeamResult> results;
+            for (int stride : { 1, 2, 4 }) {
+                for (bool indexed : { false, true }) {
+                    results.push_back(checkSeams(stride, indexed, options));
+                }
+            }
+            printSeams(results);
+            for (const auto& r : results) {
+                if (!r.vertices || r.maxDegrees > kSeamNormalTolerance) {
+                    throw std::runtime_error("check-seams: normals on stitched faces stray from the gradient");
+                }
+            }
+            return EXIT_SUCCESS;
+        }
+
+        std::vector<Result> results;
+        for (const auto& scene : makeScenes()) {
+            if (!options.scene.empty() && options.scene != scene.name) {
+                continue;
+            }
+            for (auto size : options.sizes) {
+                for (auto threads : options.threads) {
+                    results.push_back(run(scene, size, threads, options));
+                }
+            }
+        }
+
+        if (options.json) {
+            printJson(options, results);
+        } else {
+            printTable(results);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
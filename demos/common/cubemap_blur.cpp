@@ -7,7 +7,7 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/norm.hpp>
 
-#include <mc/triangle_consumer.hpp>
+#include <mc/gpu_triangle_consumer.hpp>
 
 #include "cubemap_blur.hpp"
 
@@ -175,7 +175,7 @@ BlurCubemap(mc::util::TextureHandleRef srcCubemap, float blurHalfArcWidth, int s
         vec3 { 0.0f, -1.0f, 0.0f }
     };
 
-    mc::TriangleConsumer<mc::util::VertexP3C4> fullscreenQuad;
+    mc::GpuTriangleConsumer<mc::util::VertexP3C4> fullscreenQuad;
     {
         using V = decltype(fullscreenQuad)::vertex_type;
         fullscreenQuad.start();
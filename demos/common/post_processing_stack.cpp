@@ -7,7 +7,7 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/norm.hpp>
 
-#include <mc/triangle_consumer.hpp>
+#include <mc/gpu_triangle_consumer.hpp>
 
 #include "post_processing_stack.hpp"
 
@@ -45,7 +45,7 @@ namespace detail {
 // Filter
 //
 
-void Filter::_execute(const ivec2& size, GLuint colorTex, GLuint depthTex, const mc::TriangleConsumer<detail::VertexP2T2>& clipspaceQuad)
+void Filter::_execute(const ivec2& size, GLuint colorTex, GLuint depthTex, const mc::GpuTriangleConsumer<detail::VertexP2T2>& clipspaceQuad)
 {
     if (_clearsColorBuffer) {
         glClearColor(_clearColor.r, _clearColor.g, _clearColor.b, _clearColor.a);
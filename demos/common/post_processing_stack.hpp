@@ -4,7 +4,7 @@
 #include <algorithm>
 #include <epoxy/gl.h>
 
-#include <mc/triangle_consumer.hpp>
+#include <mc/gpu_triangle_consumer.hpp>
 #include <mc/util/io.hpp>
 #include <mc/util/unowned_ptr.hpp>
 
@@ -68,10 +68,10 @@ protected:
     virtual void _update(double time) { }
 
     /// Called by FilterStack to prepare render state; you should most-likely implement _render() and leave this alone
-    virtual void _execute(const glm::ivec2& size, GLuint colorTex, GLuint depthTex, const mc::TriangleConsumer<detail::VertexP2T2>& clipspaceQuad);
+    virtual void _execute(const glm::ivec2& size, GLuint colorTex, GLuint depthTex, const mc::GpuTriangleConsumer<detail::VertexP2T2>& clipspaceQuad);
 
     /// Perform your filtered render using input as your source texture data.
-    virtual void _render(const glm::ivec2& size, GLuint colorTex, GLuint depthTex, const mc::TriangleConsumer<detail::VertexP2T2>& clipspaceQuad) = 0;
+    virtual void _render(const glm::ivec2& size, GLuint colorTex, GLuint depthTex, const mc::GpuTriangleConsumer<detail::VertexP2T2>& clipspaceQuad) = 0;
 
 private:
     friend class FilterStack;
@@ -191,7 +191,7 @@ private:
     GLuint _colorTexDst = 0;
     GLuint _depthTex = 0;
     glm::ivec2 _size { 0, 0 };
-    mc::TriangleConsumer<detail::VertexP2T2> _clipspaceQuad;
+    mc::GpuTriangleConsumer<detail::VertexP2T2> _clipspaceQuad;
 };
 
 }
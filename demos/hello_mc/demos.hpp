@@ -2,9 +2,11 @@
 #define demos_hpp
 
 #include <memory>
+#include <random>
 
 #include <epoxy/gl.h>
 
+#include <mc/util/lines.hpp>
 #include <mc/util/unowned_ptr.hpp>
 #include <mc/volume.hpp>
 #include <mc/volume_samplers.hpp>
@@ -22,6 +22,7 @@
 #include <imgui/imgui_impl_glfw.h>
 #include <imgui/imgui_impl_opengl3.h>
 
+#include <mc/gpu_triangle_consumer.hpp>
 #include <mc/marching_cubes.hpp>
 #include <mc/util/util.hpp>
 #include <mc/volume.hpp>
@@ -209,12 +210,12 @@ private:
     std::unique_ptr<VolumeMaterial> _volumeMaterial;
     std::unique_ptr<LineMaterial> _lineMaterial;
     std::unique_ptr<SkydomeMaterial> _skydomeMaterial;
-    std::vector<unique_ptr<mc::TriangleConsumer<mc::Vertex>>> _triangleConsumers;
+    std::vector<unique_ptr<mc::GpuTriangleConsumer<mc::Vertex>>> _triangleConsumers;
     mc::util::LineSegmentBuffer _octreeAABBLineSegmentStorage;
     mc::util::LineSegmentBuffer _octreeOccupiedAABBsLineSegmentStorage;
     mc::util::LineSegmentBuffer _axes;
     mc::util::LineSegmentBuffer _debugLines;
-    mc::TriangleConsumer<mc::util::VertexP3C4> _skydomeQuad;
+    mc::GpuTriangleConsumer<mc::util::VertexP3C4> _skydomeQuad;
 
     // input state
     bool _mouseButtonState[3] = { false, false, false };
@@ -496,7 +497,7 @@ private:
 
         std::vector<unowned_ptr<mc::TriangleConsumer<mc::Vertex>>> unownedTriangleConsumers;
         for (auto i = 0u; i < nThreads; i++) {
-            _triangleConsumers.push_back(make_unique<mc::TriangleConsumer<mc::Vertex>>());
+            _triangleConsumers.push_back(make_unique<mc::GpuTriangleConsumer<mc::Vertex>>());
             unownedTriangleConsumers.push_back(_triangleConsumers.back().get());
         }
 
@@ -655,6 +656,12 @@ private:
             _needsMarchVolume = true;
         }
 
+        bool surfaceNets = _volume->getExtractor() == mc::Extractor::SurfaceNets;
+        if (ImGui::Checkbox("Surface Nets", &surfaceNets)) {
+            _volume->setExtractor(surfaceNets ? mc::Extractor::SurfaceNets : mc::Extractor::MarchingCubes);
+            _needsMarchVolume = true;
+        }
+
         float shininess = _volumeMaterial->shininess();
         if (ImGui::SliderFloat("Shininess", &shininess, 0, 1)) {
             _volumeMaterial->setShininess(shininess);
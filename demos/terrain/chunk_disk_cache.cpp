@@ -0,0 +1,209 @@
+#include "chunk_disk_cache.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+const char kMagic[4] = { 'M', 'C', 'C', 'K' };
+
+std::size_t fileSizeFor(const ChunkDiskCache::FileHeader& header)
+{
+    return sizeof(ChunkDiskCache::FileHeader)
+        + header.numNodes * sizeof(ChunkDiskCache::NodeRecord)
+        + header.numVertices * sizeof(mc::PackedVertex)
+        + header.numIndices * sizeof(uint32_t);
+}
+
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+ChunkDiskCache::MappedMesh::MappedMesh(void* data, std::size_t size)
+    : _data(data)
+    , _size(size)
+{
+}
+
+ChunkDiskCache::MappedMesh::~MappedMesh()
+{
+    munmap(_data, _size);
+}
+
+const ChunkDiskCache::NodeRecord* ChunkDiskCache::MappedMesh::nodes() const
+{
+    return reinterpret_cast<const NodeRecord*>(static_cast<const char*>(_data) + sizeof(FileHeader));
+}
+
+const mc::PackedVertex* ChunkDiskCache::MappedMesh::vertices() const
+{
+    return reinterpret_cast<const mc::PackedVertex*>(nodes() + header().numNodes);
+}
+
+mc::util::AABB ChunkDiskCache::MappedMesh::bounds() const
+{
+    const auto& h = header();
+    return mc::util::AABB(
+        glm::vec3(h.boundsMin[0], h.boundsMin[1], h.boundsMin[2]),
+        glm::vec3(h.boundsMax[0], h.boundsMax[1], h.boundsMax[2]));
+}
+
+const uint32_t* ChunkDiskCache::MappedMesh::indices() const
+{
+    return reinterpret_cast<const uint32_t*>(vertices() + header().numVertices);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+ChunkDiskCache::ChunkDiskCache(std::string directory)
+    : _directory(std::move(directory))
+{
+    std::error_code err;
+    std::filesystem::create_directories(_directory, err);
+    if (err) {
+        std::cerr << "[ChunkDiskCache::ctor] - unable to create directory: " << _directory
+                  << " error: " << err.message() << std::endl;
+    }
+
+    _writer = std::thread([this]() { writerLoop(); });
+}
+
+ChunkDiskCache::~ChunkDiskCache()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _condition.notify_all();
+    _writer.join();
+}
+
+std::unique_ptr<ChunkDiskCache::MappedMesh> ChunkDiskCache::load(uint64_t identity, glm::ivec2 index) const
+{
+    const auto path = pathFor(identity, index);
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(FileHeader)) {
+        close(fd);
+        return nullptr;
+    }
+
+    const auto size = static_cast<std::size_t>(info.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+
+    auto mesh = std::make_unique<MappedMesh>(data, size);
+    const auto& header = mesh->header();
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0
+        || header.version != kFormatVersion
+        || header.vertexSize != sizeof(mc::PackedVertex)
+        || header.identity != identity
+        || header.index[0] != index.x
+        || header.index[1] != index.y
+        || fileSizeFor(header) != size) {
+        return nullptr;
+    }
+
+    return mesh;
+}
+
+void ChunkDiskCache::store(uint64_t identity, glm::ivec2 index, const mc::util::AABB& bounds,
+    std::vector<NodeRecord> nodes,
+    std::unique_ptr<mc::TriangleConsumer<mc::PackedVertex>> geometry)
+{
+    FileHeader header {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kFormatVersion;
+    header.vertexSize = sizeof(mc::PackedVertex);
+    header.numNodes = static_cast<uint32_t>(nodes.size());
+    header.numVertices = geometry->getVertices().size();
+    header.numIndices = 0;
+    header.identity = identity;
+    header.index[0] = index.x;
+    header.index[1] = index.y;
+    for (int i = 0; i < 3; i++) {
+        header.boundsMin[i] = bounds.min[i];
+        header.boundsMax[i] = bounds.max[i];
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending.push_back(PendingWrite { pathFor(identity, index), header, std::move(nodes), std::move(geometry) });
+    }
+    _condition.notify_all();
+}
+
+void ChunkDiskCache::flush()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _condition.wait(lock, [this] { return _pending.empty() && !_writing; });
+}
+
+std::string ChunkDiskCache::pathFor(uint64_t identity, glm::ivec2 index) const
+{
+    std::stringstream ss;
+    ss << _directory << "/" << std::hex << identity << std::dec << "_" << index.x << "_" << index.y << ".mcchunk";
+    return ss.str();
+}
+
+void ChunkDiskCache::write(const PendingWrite& pending) const
+{
+    // write to a temporary file and rename it into place, so a reader never maps a partial file
+    const auto tempPath = pending.path + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        const auto& vertices = pending.geometry->getVertices();
+        out.write(reinterpret_cast<const char*>(&pending.header), sizeof(FileHeader));
+        out.write(reinterpret_cast<const char*>(pending.nodes.data()), pending.nodes.size() * sizeof(NodeRecord));
+        out.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(mc::PackedVertex));
+        if (!out) {
+            std::cerr << "[ChunkDiskCache::write] - unable to write: " << tempPath << std::endl;
+            std::remove(tempPath.c_str());
+            return;
+        }
+    }
+
+    if (std::rename(tempPath.c_str(), pending.path.c_str()) != 0) {
+        std::cerr << "[ChunkDiskCache::write] - unable to rename: " << tempPath << std::endl;
+        std::remove(tempPath.c_str());
+    }
+}
+
+void ChunkDiskCache::writerLoop()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+        _condition.wait(lock, [this] { return _stop || !_pending.empty(); });
+        if (_pending.empty()) {
+            // stopping, and all writes are done
+            return;
+        }
+
+        auto pending = std::move(_pending.front());
+        _pending.pop_front();
+        _writing = true;
+
+        lock.unlock();
+        write(pending);
+        lock.lock();
+
+        _writing = false;
+        _condition.notify_all();
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef chunk_disk_cache_hpp
+#define chunk_disk_cache_hpp
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <mc/marching_cubes.hpp>
+#include <mc/triangle_consumer.hpp>
+
+/**
+ * Persistent cache of marched TerrainChunk meshes, one file per chunk, keyed by chunk
+ * index and the identity of the terrain & greeble sources which produced them.
+ * Files are written on a background thread, and loaded by memory-mapping them, so
+ * vertices are read in place, with no parsing. They're stored as mc::PackedVertex,
+ * packed against the bounds recorded in the header, for files ~2.6x smaller than
+ * mc::Vertex would make; they're unpacked as they're uploaded.
+ *
+ * File format (native endianness; version kFormatVersion):
+ *  FileHeader
+ *  NodeRecord[header.numNodes]           - the octree nodes which were marched
+ *  mc::PackedVertex[header.numVertices]  - non-indexed triangles, three vertices each
+ *  uint32_t[header.numIndices]           - reserved for indexed meshes; currently always empty
+ * A file whose header doesn't match the current version, vertex size, identity and
+ * chunk index, or whose size doesn't match its header, is ignored.
+ */
+class ChunkDiskCache {
+public:
+    static constexpr uint32_t kFormatVersion = 2;
+
+    struct NodeRecord {
+        float min[3];
+        float max[3];
+        int32_t depth;
+        int32_t reserved;
+    };
+
+    struct FileHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t vertexSize;
+        uint32_t numNodes;
+        uint64_t numVertices;
+        uint64_t numIndices;
+        uint64_t identity;
+        int32_t index[2];
+        // the bounds vertices were packed against
+        float boundsMin[3];
+        float boundsMax[3];
+    };
+
+    /**
+     * A memory-mapped chunk mesh file; the mapping is released on destruction.
+     */
+    class MappedMesh {
+    public:
+        MappedMesh(void* data, std::size_t size);
+        ~MappedMesh();
+        MappedMesh(const MappedMesh&) = delete;
+        MappedMesh& operator=(const MappedMesh&) = delete;
+
+        const FileHeader& header() const { return *static_cast<const FileHeader*>(_data); }
+        const NodeRecord* nodes() const;
+        const mc::PackedVertex* vertices() const;
+        mc::util::AABB bounds() const;
+        const uint32_t* indices() const;
+
+    private:
+        void* _data;
+        std::size_t _size;
+    };
+
+public:
+    // Create a cache storing files in directory, which is created if necessary.
+    explicit ChunkDiskCache(std::string directory);
+
+    // Blocks until pending writes complete.
+    ~ChunkDiskCache();
+
+    ChunkDiskCache(const ChunkDiskCache&) = delete;
+    ChunkDiskCache& operator=(const ChunkDiskCache&) = delete;
+
+    // Maps the mesh file for the chunk at index, or returns null if there is no valid file.
+    std::unique_ptr<MappedMesh> load(uint64_t identity, glm::ivec2 index) const;
+
+    // Queues the chunk's mesh, whose vertices were packed against bounds, to be written
+    // by the background thread.
+    void store(uint64_t identity, glm::ivec2 index, const mc::util::AABB& bounds,
+        std::vector<NodeRecord> nodes,
+        std::unique_ptr<mc::TriangleConsumer<mc::PackedVertex>> geometry);
+
+    // Blocks until pending writes complete.
+    void flush();
+
+private:
+    struct PendingWrite {
+        std::string path;
+        FileHeader header;
+        std::vector<NodeRecord> nodes;
+        std::unique_ptr<mc::TriangleConsumer<mc::PackedVertex>> geometry;
+    };
+
+    std::string pathFor(uint64_t identity, glm::ivec2 index) const;
+    void write(const PendingWrite& pending) const;
+    void writerLoop();
+
+    std::string _directory;
+    std::deque<PendingWrite> _pending;
+    bool _writing = false;
+    bool _stop = false;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::thread _writer;
+};
+
+#endif /* chunk_disk_cache_hpp */
@@ -0,0 +1,131 @@
+#ifndef chunk_mesh_cache_hpp
+#define chunk_mesh_cache_hpp
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+#include <mc/marching_cubes.hpp>
+#include <mc/triangle_consumer.hpp>
+#include <mc/util/unowned_ptr.hpp>
+
+/**
+ * Bounded LRU cache of marched TerrainChunk meshes, keyed by chunk index, level of
+ * detail (and that of the neighbors it's stitched to) and the identity of the terrain
+ * source which produced them. Vertices are stored as mc::PackedVertex, packed against
+ * the bounds of the chunk's volume, so the budget holds ~2.6x the meshes mc::Vertex
+ * would. When the cached meshes exceed the memory budget, the least recently used are
+ * evicted.
+ */
+class ChunkMeshCache {
+public:
+    using Mesh = mc::TriangleConsumer<mc::PackedVertex>;
+
+    struct Key {
+        glm::ivec2 index;
+        const void* source = nullptr;
+        int lod = 0;
+        int stitching = 0;
+
+        bool operator==(const Key& other) const
+        {
+            return index == other.index && source == other.source && lod == other.lod && stitching == other.stitching;
+        }
+    };
+
+    explicit ChunkMeshCache(std::size_t budgetBytes)
+        : _budgetBytes(budgetBytes)
+    {
+    }
+
+    ChunkMeshCache(const ChunkMeshCache&) = delete;
+    ChunkMeshCache& operator=(const ChunkMeshCache&) = delete;
+
+    // Returns the mesh cached for key, marking it most recently used, or null if none is cached.
+    mc::util::unowned_ptr<const Mesh> find(const Key& key)
+    {
+        auto pos = _lookup.find(key);
+        if (pos == _lookup.end()) {
+            return nullptr;
+        }
+
+        _entries.splice(_entries.begin(), _entries, pos->second);
+        return pos->second->second.get();
+    }
+
+    // Caches mesh under key, replacing any mesh already cached for it.
+    void insert(const Key& key, std::unique_ptr<Mesh>&& mesh)
+    {
+        erase(key);
+
+        _bytes += bytesFor(*mesh);
+        _entries.emplace_front(key, std::move(mesh));
+        _lookup[key] = _entries.begin();
+        evict();
+    }
+
+    void erase(const Key& key)
+    {
+        auto pos = _lookup.find(key);
+        if (pos != _lookup.end()) {
+            _bytes -= bytesFor(*pos->second->second);
+            _entries.erase(pos->second);
+            _lookup.erase(pos);
+        }
+    }
+
+    void clear()
+    {
+        _entries.clear();
+        _lookup.clear();
+        _bytes = 0;
+    }
+
+    void setBudget(std::size_t budgetBytes)
+    {
+        _budgetBytes = budgetBytes;
+        evict();
+    }
+
+    std::size_t getBudget() const { return _budgetBytes; }
+    std::size_t getBytes() const { return _bytes; }
+    std::size_t size() const { return _entries.size(); }
+
+private:
+    struct KeyHash {
+        std::size_t operator()(const Key& key) const
+        {
+            const std::size_t h = std::hash<int>()(key.index.x) * 73856093 ^ std::hash<int>()(key.index.y) * 19349663;
+            return h ^ std::hash<const void*>()(key.source) ^ std::hash<int>()(key.lod * 16 + key.stitching) * 83492791;
+        }
+    };
+
+    using Entry = std::pair<Key, std::unique_ptr<Mesh>>;
+
+    static std::size_t bytesFor(const Mesh& mesh)
+    {
+        return mesh.getVertices().size() * sizeof(mc::PackedVertex);
+    }
+
+    void evict()
+    {
+        while (_bytes > _budgetBytes && !_entries.empty()) {
+            const auto& lru = _entries.back();
+            _bytes -= bytesFor(*lru.second);
+            _lookup.erase(lru.first);
+            _entries.pop_back();
+        }
+    }
+
+    std::size_t _budgetBytes;
+    std::size_t _bytes = 0;
+
+    // front is most recently used
+    std::list<Entry> _entries;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> _lookup;
+};
+
+#endif /* chunk_mesh_cache_hpp */
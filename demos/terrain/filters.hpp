@@ -17,7 +17,7 @@ public:
     }
 
 protected:
-    void _render(const glm::ivec2& size, GLuint colorTex, GLuint depthTex, const mc::TriangleConsumer<post_processing::detail::VertexP2T2>& clipspaceQuad) override
+    void _render(const glm::ivec2& size, GLuint colorTex, GLuint depthTex, const mc::GpuTriangleConsumer<post_processing::detail::VertexP2T2>& clipspaceQuad) override
     {
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, colorTex);
@@ -72,7 +72,7 @@ public:
     glm::ivec3 getPaletteSize() const { return _paletteSize; }
 
 protected:
-    void _render(const glm::ivec2& size, GLuint colorTex, GLuint depthTex, const mc::TriangleConsumer<post_processing::detail::VertexP2T2>& clipspaceQuad) override
+    void _render(const glm::ivec2& size, GLuint colorTex, GLuint depthTex, const mc::GpuTriangleConsumer<post_processing::detail::VertexP2T2>& clipspaceQuad) override
     {
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, colorTex);
@@ -114,7 +114,7 @@ public:
     int getPixelSize() const { return _pixelSize; }
 
 protected:
-    void _render(const glm::ivec2& size, GLuint colorTex, GLuint depthTex, const mc::TriangleConsumer<post_processing::detail::VertexP2T2>& clipspaceQuad) override
+    void _render(const glm::ivec2& size, GLuint colorTex, GLuint depthTex, const mc::GpuTriangleConsumer<post_processing::detail::VertexP2T2>& clipspaceQuad) override
     {
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, colorTex);
@@ -209,7 +209,7 @@ protected:
         _time += deltaT;
     }
 
-    void _render(const glm::ivec2& size, GLuint colorTex, GLuint depthTex, const mc::TriangleConsumer<post_processing::detail::VertexP2T2>& clipspaceQuad) override
+    void _render(const glm::ivec2& size, GLuint colorTex, GLuint depthTex, const mc::GpuTriangleConsumer<post_processing::detail::VertexP2T2>& clipspaceQuad) override
     {
         const float alpha = getAlpha();
 
@@ -372,7 +372,7 @@ protected:
         _groundFogWorldOffset += _fogWindSpeed * deltaT;
     }
 
-    void _render(const glm::ivec2& size, GLuint colorTex, GLuint depthTex, const mc::TriangleConsumer<post_processing::detail::VertexP2T2>& clipspaceQuad) override
+    void _render(const glm::ivec2& size, GLuint colorTex, GLuint depthTex, const mc::GpuTriangleConsumer<post_processing::detail::VertexP2T2>& clipspaceQuad) override
     {
         glActiveTexture(GL_TEXTURE0);
         glBindTexture(GL_TEXTURE_2D, colorTex);
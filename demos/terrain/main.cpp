@@ -31,6 +31,7 @@
 #include "filters.hpp"
 #include "materials.hpp"
 #include "terrain.hpp"
+#include "terrain_sources.hpp"
 
 using namespace glm;
 using mc::util::AABB;
@@ -52,34 +53,10 @@ constexpr float kUiScale = 1.75F;
 constexpr float kWorldRadius = 400;
 constexpr int kTerrainGridSize = 3;
 constexpr int kTerrainChunkSize = 128;
-
-const mc::MaterialState kFloorTerrainMaterial {
-    glm::vec4(1, 1, 1, 1),
-    0.3,
-    0,
-    0
-};
-
-const mc::MaterialState kLowTerrainMaterial {
-    glm::vec4(1, 1, 1, 1),
-    0,
-    1,
-    0
-};
-
-const mc::MaterialState kHighTerrainMaterial {
-    glm::vec4(1, 1, 1, 1),
-    0,
-    0,
-    1
-};
-
-const mc::MaterialState kArchMaterial {
-    glm::vec4(0.2, 0.2, 0.25, 1),
-    0.1,
-    0,
-    1
-};
+constexpr int kTerrainChunksInFlight = 3;
+constexpr int kTerrainLodRingsPerLevel = 1;
+constexpr bool kTerrainAdaptiveMarching = true;
+constexpr const char* kTerrainDiskCacheDirectory = "terrain_cache";
 
 //
 // App
@@ -352,98 +329,13 @@ private:
         // build the terrain grid
         //
 
-        class LumpyTerrainSource : public TerrainSampler::SampleSource {
-        private:
-            FastNoise& _noise;
-            float _maxHeight;
-
-        public:
-            LumpyTerrainSource(FastNoise& noise, float maxHeight)
-                : _noise(noise)
-                , _maxHeight(maxHeight)
-            {
-            }
-            float maxHeight() const override
-            {
-                return _maxHeight;
-            }
-            float sample(const vec3& world, mc::MaterialState& material) const override
-            {
-                if (world.y < 1e-3F) {
-                    material = kFloorTerrainMaterial;
-                    return 1;
-                }
-
-                float noise2D = _noise.GetSimplex(world.x, world.z);
-                float noise3D = _noise.GetSimplex(world.x * 11, world.y * 11, world.z * 11);
-                float height = std::max(_maxHeight * noise2D, 0.0F);
-                float contribution = 0;
-                if (world.y < height) {
-                    float a = (height - world.y) / height;
-                    contribution = a * (a + 0.6F * noise3D);
-                }
-
-                float k = world.y / (0.5F * _maxHeight);
-                if (k < 0.1) {
-                    material = mix(kFloorTerrainMaterial, kLowTerrainMaterial, k / 0.1F);
-                } else {
-                    k = (k - 0.1F) / 0.9F;
-                    material = mix(kLowTerrainMaterial, kHighTerrainMaterial, min(k, 1.0F));
-                }
-
-                return contribution;
-            }
-        };
-
-        class Greebler : public GreebleSource {
-        private:
-            FastNoise& _noise;
-
-        public:
-            Greebler(FastNoise& fn)
-                : _noise(fn)
-            {
-            }
-
-            int sampleStepSize() const override
-            {
-                return 15;
-            }
-
-            Sample sample(const vec3 world) const override
-            {
-                const float probability = (_noise.GetSimplex(world.x, world.z) + 1) * 0.5F; // map to [0,1]
-                const uint64_t seed = static_cast<uint64_t>(12345 + probability * 678910);
-                auto rng = rng_xorshift64 { seed };
-                const vec3 offset { rng.nextFloat(-5, 5), rng.nextFloat(-5, 5), rng.nextFloat(-5, 5) };
-                return Sample { probability, offset, seed };
-            }
-
-            std::unique_ptr<mc::IVolumeSampler> evaluate(const Sample& sample, const vec3& local) const override
-            {
-                if (sample.probability > 0.8) {
-                    auto rng = rng_xorshift64 { sample.seed };
-                    Tube::Config arch;
-                    arch.axisOrigin = vec3 { local.x + sample.offset.x, 0, local.z + sample.offset.y };
-                    arch.innerRadiusAxisOffset = vec3(0, rng.nextFloat(4, 10), 0);
-                    arch.axisDir = normalize(vec3(rng.nextFloat(-1, 1), rng.nextFloat(-0.2, 0.2), rng.nextFloat(1, 1)));
-                    arch.axisPerp = normalize(vec3(rng.nextFloat(-0.2, 0.2), 1, 0));
-                    arch.length = rng.nextFloat(3, 7);
-                    arch.innerRadius = rng.nextFloat(10, 15);
-                    arch.outerRadius = rng.nextFloat(20, 35);
-                    arch.frontFaceNormal = arch.axisDir;
-                    arch.backFaceNormal = -arch.axisDir;
-                    arch.cutAngleRadians = radians(rng.nextFloat(16, 32));
-                    arch.material = kArchMaterial;
-                    return std::make_unique<Tube>(arch);
-                }
-                return nullptr;
-            }
-        };
-
         std::unique_ptr<TerrainSampler::SampleSource> terrainSource = std::make_unique<LumpyTerrainSource>(_fastNoise, terrainHeight);
         std::unique_ptr<GreebleSource> greebleSource = std::make_unique<Greebler>(_fastNoise);
         _terrainGrid = std::make_unique<TerrainGrid>(kTerrainGridSize, kTerrainChunkSize, std::move(terrainSource), std::move(greebleSource));
+        _terrainGrid->setMaxChunksInFlight(kTerrainChunksInFlight);
+        _terrainGrid->setLodRingsPerLevel(kTerrainLodRingsPerLevel);
+        _terrainGrid->setAdaptiveMarching(kTerrainAdaptiveMarching);
+        _terrainGrid->setDiskCache(std::make_unique<ChunkDiskCache>(kTerrainDiskCacheDirectory));
 
         auto pos = vec3(0, terrainHeight, 0);
         auto lookTarget = pos + vec3(0, 0, 1);
@@ -22,31 +22,41 @@ vec4 nodeColor(int atDepth)
     return rainbow((atDepth % 8) / 8.0F);
 }
 
+void addNodeBounds(mc::util::LineSegmentBuffer& lineBuffer, mc::OctreeVolume::Node* node)
+{
+    auto bounds = node->bounds;
+    bounds.inset(node->depth * 0.005F);
+    lineBuffer.add(bounds, nodeColor(node->depth));
+}
+
 }
 
-TerrainChunk::TerrainChunk(int size, mc::util::unowned_ptr<TerrainSampler::SampleSource> terrain)
+TerrainChunk::TerrainChunk(int size, mc::util::unowned_ptr<TerrainSampler::SampleSource> terrain,
+    mc::util::unowned_ptr<mc::util::ThreadPool> threadPool)
     : _index(0, 0)
     , _size(size)
     , _maxHeight(terrain->maxHeight())
-    , _threadPool(std::thread::hardware_concurrency(), true)
     , _terrainSampleSource(terrain)
 {
     std::vector<mc::util::unowned_ptr<mc::TriangleConsumer<mc::Vertex>>> unownedTriangleConsumers;
-    for (size_t i = 0, N = _threadPool.size(); i < N; i++) {
-        _triangles.push_back(std::make_unique<mc::TriangleConsumer<mc::Vertex>>());
+    for (size_t i = 0, N = threadPool->size(); i < N; i++) {
+        _triangles.push_back(std::make_unique<mc::GpuTriangleConsumer<mc::Vertex>>());
         unownedTriangleConsumers.push_back(_triangles.back().get());
     }
 
     const int minNodeSize = 4;
     const float fuzziness = 2.0F;
-    _volume = std::make_unique<mc::OctreeVolume>(size, fuzziness, minNodeSize, &_threadPool, unownedTriangleConsumers);
+    _volume = std::make_unique<mc::OctreeVolume>(size, fuzziness, minNodeSize, threadPool, unownedTriangleConsumers);
 }
 
 void TerrainChunk::setIndex(ivec2 index)
 {
     _needsMarch = true;
     _index = index;
+
+    // moving the chunk changes every sampler, so start over
     _volume->clear();
+    _greebles.clear();
     for (auto& tc : _triangles) {
         tc->clear();
     }
@@ -66,19 +76,67 @@ void TerrainChunk::setIndex(ivec2 index)
     _boundingLineBuffer.add(AABB(vec3 { 0.0F }, size).inset(1), segmentColor);
 }
 
+void TerrainChunk::setLod(int lod, const std::array<int, 4>& neighborLods)
+{
+    if (lod == _lod && neighborLods == _neighborLods) {
+        return;
+    }
+
+    _lod = lod;
+    _neighborLods = neighborLods;
+
+    // chunks neighbor on x & z, the volume's -x, +x, -z & +z faces
+    mc::MarchOptions options;
+    options.stride = 1 << _lod;
+    const int faces[4] = { 0, 1, 4, 5 };
+    for (int i = 0; i < 4; i++) {
+        options.neighborStrides[faces[i]] = _neighborLods[i] >= 0 ? 1 << _neighborLods[i] : 0;
+    }
+
+    _volume->setMarchOptions(options);
+    _needsMarch = true;
+}
+
+int TerrainChunk::getStitching() const
+{
+    int stitching = 0;
+    for (int i = 0; i < 4; i++) {
+        if (_neighborLods[i] > _lod) {
+            stitching |= _neighborLods[i] << (i * 4);
+        }
+    }
+    return stitching;
+}
+
+void TerrainChunk::setAdaptiveMarching(bool adaptive)
+{
+    if (adaptive == _volume->isAdaptiveMarching()) {
+        return;
+    }
+
+    _volume->setAdaptiveMarching(adaptive);
+    _needsMarch = true;
+}
+
+void TerrainChunk::updateGreebling(const GreebleSource& greebleSource)
+{
+    for (auto greeble : _greebles) {
+        _volume->remove(greeble);
+    }
+    _greebles = greebleSource.addGreebles(_bounds, *_volume);
+}
+
 void TerrainChunk::march(std::function<void()> onComplete)
 {
     const double startTime = glfwGetTime();
 
     _aabbLineBuffer.clear();
+    _marchedNodes.clear();
 
     const auto nodeObserver = [this](mc::OctreeVolume::Node* node) {
-        {
-            // update the occupied aabb display
-            auto bounds = node->bounds;
-            bounds.inset(node->depth * 0.005F);
-            _aabbLineBuffer.add(bounds, nodeColor(node->depth));
-        }
+        // update the occupied aabb display
+        addNodeBounds(_aabbLineBuffer, node);
+        _marchedNodes.push_back(node);
     };
 
     const auto onMarchComplete = [this, startTime, onComplete]() {
@@ -92,6 +150,86 @@ void TerrainChunk::march(std::function<void()> onComplete)
     _volume->marchAsync(onMarchComplete, nodeObserver);
 }
 
+void TerrainChunk::restoreGeometry(const mc::TriangleConsumer<mc::PackedVertex>& geometry)
+{
+    const double startTime = glfwGetTime();
+
+    // the volume still needs its nodes marked, since raycasts sample them
+    _marchedNodes.clear();
+    _volume->collect(_marchedNodes);
+
+    _aabbLineBuffer.clear();
+    for (auto node : _marchedNodes) {
+        addNodeBounds(_aabbLineBuffer, node);
+    }
+
+    for (auto& tc : _triangles) {
+        tc->start();
+    }
+    const auto bounds = getPackBounds();
+    const auto& vertices = geometry.getVertices();
+    for (std::size_t i = 0; i + 2 < vertices.size(); i += 3) {
+        _triangles.front()->addTriangle(mc::Triangle<mc::Vertex>(
+            vertices[i].unpack(bounds),
+            vertices[i + 1].unpack(bounds),
+            vertices[i + 2].unpack(bounds)));
+    }
+    for (auto& tc : _triangles) {
+        tc->finish();
+    }
+
+    _lastMarchDurationSeconds = glfwGetTime() - startTime;
+    _needsMarch = false;
+}
+
+void TerrainChunk::restoreGeometry(const ChunkDiskCache::MappedMesh& mesh)
+{
+    const double startTime = glfwGetTime();
+
+    // the volume still needs its nodes marked, since raycasts sample them
+    _marchedNodes.clear();
+    _volume->collect(_marchedNodes);
+
+    // but the aabb display can come from the file's node table
+    _aabbLineBuffer.clear();
+    const auto nodes = mesh.nodes();
+    for (uint32_t i = 0, N = mesh.header().numNodes; i < N; i++) {
+        auto bounds = AABB(vec3(nodes[i].min[0], nodes[i].min[1], nodes[i].min[2]), vec3(nodes[i].max[0], nodes[i].max[1], nodes[i].max[2]));
+        bounds.inset(nodes[i].depth * 0.005F);
+        _aabbLineBuffer.add(bounds, nodeColor(nodes[i].depth));
+    }
+
+    const auto bounds = mesh.bounds();
+    const auto packed = mesh.vertices();
+    std::vector<mc::Vertex> vertices(mesh.header().numVertices);
+    for (std::size_t i = 0; i < vertices.size(); i++) {
+        vertices[i] = packed[i].unpack(bounds);
+    }
+    _triangles.front()->upload(vertices.data(), vertices.size());
+    for (std::size_t i = 1; i < _triangles.size(); i++) {
+        _triangles[i]->clear();
+    }
+
+    _lastMarchDurationSeconds = glfwGetTime() - startTime;
+    _needsMarch = false;
+}
+
+std::unique_ptr<mc::TriangleConsumer<mc::PackedVertex>> TerrainChunk::packGeometry() const
+{
+    const auto bounds = getPackBounds();
+    auto geometry = std::make_unique<mc::TriangleConsumer<mc::PackedVertex>>();
+    for (const auto& tc : _triangles) {
+        const auto& vertices = tc->getVertices();
+        for (std::size_t i = 0; i + 2 < vertices.size(); i += 3) {
+            geometry->addTriangle(mc::Triangle<mc::PackedVertex>(
+                mc::PackedVertex::pack(vertices[i], bounds),
+                mc::PackedVertex::pack(vertices[i + 1], bounds),
+                mc::PackedVertex::pack(vertices[i + 2], bounds)));
+        }
+    }
+    return geometry;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 namespace {
@@ -110,18 +248,35 @@ TerrainGrid::TerrainGrid(int gridSize, int chunkSize,
     , _chunkSize(chunkSize)
     , _terrainSampleSource(std::move(terrainSampleSource))
     , _greebleSource(std::move(greebleSource))
+    , _threadPool(std::thread::hardware_concurrency(), true)
+    , _meshCache(kDefaultMeshCacheBudgetBytes)
 {
     _grid.resize(_gridSize * _gridSize);
     for (int i = 0; i < _gridSize; i++) {
         for (int j = 0; j < _gridSize; j++) {
             int k = i * _gridSize + j;
-            _grid[k] = std::make_unique<TerrainChunk>(chunkSize, _terrainSampleSource.get());
+            _grid[k] = std::make_unique<TerrainChunk>(chunkSize, _terrainSampleSource.get(), &_threadPool);
             _grid[k]->setIndex(ivec2(j - _gridSize / 2, i - _gridSize / 2));
         }
     }
     _centerOffset = (_gridSize * _gridSize) / 2;
 }
 
+void TerrainGrid::setAdaptiveMarching(bool adaptive)
+{
+    if (adaptive == _adaptiveMarching) {
+        return;
+    }
+
+    _adaptiveMarching = adaptive;
+    for (const auto& chunk : _grid) {
+        chunk->setAdaptiveMarching(adaptive);
+    }
+
+    // cached meshes were marched the other way
+    _meshCache.clear();
+}
+
 glm::ivec2 TerrainGrid::worldToIndex(const glm::vec3& world) const
 {
     auto idx = ivec2(world.x / _chunkSize, world.z / _chunkSize);
@@ -212,6 +367,8 @@ void TerrainGrid::print()
 
 void TerrainGrid::march(const glm::vec3& viewPos, const glm::vec3& viewDir)
 {
+    updateLevelsOfDetail();
+
     // collect all TerrainChunk instances which need to be marched, and aren't being marched
     _dirtyChunks.clear();
     for (const auto& chunk : _grid) {
@@ -229,11 +386,24 @@ void TerrainGrid::march(const glm::vec3& viewPos, const glm::vec3& viewDir)
         return da < db;
     });
 
-    // now march the queue serially from back to front
+    if (_dirtyChunks.empty()) {
+        return;
+    }
+
+    // chunks whose mesh is cached are restored rather than marched
+    updateGreebling();
+    std::vector<TerrainChunk*> uncachedChunks;
+    for (auto chunk : _dirtyChunks) {
+        if (!restoreFromCache(chunk)) {
+            uncachedChunks.push_back(chunk);
+        }
+    }
+    _dirtyChunks = std::move(uncachedChunks);
+
+    // now march the queue from back to front
     if (!_dirtyChunks.empty()) {
         _isMarching = true;
-        updateGreebling();
-        marchSerially();
+        marchDirtyChunks();
     }
 }
 
@@ -346,12 +516,89 @@ bool TerrainGrid::samplerIntersects(mc::IVolumeSampler* sampler, const vec3& sam
     return sampler->intersects(relativeBounds);
 }
 
-namespace {
-float snap(float v, int step)
+ChunkMeshCache::Key TerrainGrid::meshCacheKey(const TerrainChunk* chunk) const
 {
-    int x = v / step;
-    return x * step;
+    return ChunkMeshCache::Key { chunk->getIndex(), _terrainSampleSource.get(), chunk->getLod(), chunk->getStitching() };
 }
+
+uint64_t TerrainGrid::diskCacheIdentity(const TerrainChunk* chunk) const
+{
+    const uint64_t terrainIdentity = _terrainSampleSource->identity();
+    if (!terrainIdentity) {
+        return 0;
+    }
+
+    const uint64_t greebleIdentity = _greebleSource ? _greebleSource->identity() : 0;
+    const uint64_t lod = static_cast<uint64_t>(chunk->getLod()) << 32 | static_cast<uint64_t>(chunk->getStitching()) << 40
+        | static_cast<uint64_t>(_adaptiveMarching) << 58;
+    return terrainIdentity ^ (greebleIdentity * 0x9E3779B97F4A7C15ULL) ^ (static_cast<uint64_t>(_chunkSize) | lod);
+}
+
+bool TerrainGrid::restoreFromCache(TerrainChunk* chunk)
+{
+    if (const auto geometry = _meshCache.find(meshCacheKey(chunk))) {
+        chunk->restoreGeometry(*geometry);
+        return true;
+    }
+
+    const auto identity = diskCacheIdentity(chunk);
+    if (_diskCache && identity) {
+        if (const auto mesh = _diskCache->load(identity, chunk->getIndex())) {
+            chunk->restoreGeometry(*mesh);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void TerrainGrid::storeInCache(TerrainChunk* chunk)
+{
+    auto geometry = chunk->packGeometry();
+
+    const auto identity = diskCacheIdentity(chunk);
+    if (_diskCache && identity) {
+        std::vector<ChunkDiskCache::NodeRecord> nodes;
+        for (auto node : chunk->getMarchedNodes()) {
+            const auto& b = node->bounds;
+            nodes.push_back(ChunkDiskCache::NodeRecord {
+                { b.min.x, b.min.y, b.min.z },
+                { b.max.x, b.max.y, b.max.z },
+                static_cast<int32_t>(node->depth),
+                0 });
+        }
+        auto copy = std::make_unique<mc::TriangleConsumer<mc::PackedVertex>>();
+        copy->addTriangles(*geometry);
+        _diskCache->store(identity, chunk->getIndex(), chunk->getPackBounds(), std::move(nodes), std::move(copy));
+    }
+
+    _meshCache.insert(meshCacheKey(chunk), std::move(geometry));
+}
+
+void TerrainGrid::updateLevelsOfDetail()
+{
+    // row i of the grid runs along x, column j along z
+    const int center = _gridSize / 2;
+    const auto lodAt = [this, center](int i, int j) {
+        if (i < 0 || j < 0 || i >= _gridSize || j >= _gridSize) {
+            return -1;
+        }
+        const int ring = std::max(std::abs(i - center), std::abs(j - center));
+        return _lodRingsPerLevel > 0 ? std::min(ring / _lodRingsPerLevel, kMaxLod) : 0;
+    };
+
+    for (int i = 0; i < _gridSize; i++) {
+        for (int j = 0; j < _gridSize; j++) {
+            const auto& chunk = _grid[i * _gridSize + j];
+
+            // a marching chunk's volume is in use; it will be updated by a later march()
+            if (chunk->isWorking()) {
+                continue;
+            }
+
+            chunk->setLod(lodAt(i, j), { lodAt(i, j - 1), lodAt(i, j + 1), lodAt(i - 1, j), lodAt(i + 1, j) });
+        }
+    }
 }
 
 void TerrainGrid::updateGreebling()
@@ -359,36 +606,28 @@ void TerrainGrid::updateGreebling()
     if (!_greebleSource)
         return;
 
-    const int step = _greebleSource->sampleStepSize();
     for (const auto& chunk : _dirtyChunks) {
-        const auto chunkBounds = chunk->getBounds();
-        const auto extent = chunkBounds.size();
-        const auto range = AABB(
-            vec3(snap(chunkBounds.min.x - extent.x, step), chunkBounds.min.y, snap(chunkBounds.min.z - extent.z, step)),
-            vec3(snap(chunkBounds.max.x + extent.x, step), chunkBounds.max.y, snap(chunkBounds.max.z + extent.z, step)));
-
-        for (float x = range.min.x; x <= range.max.x; x += step) {
-            for (float z = range.min.z; z <= range.max.z; z += step) {
-                const vec3 world(x, 0, z);
-                const GreebleSource::Sample sample = _greebleSource->sample(world);
-                const vec3 local(world.x - chunkBounds.min.x, 0, world.z - chunkBounds.min.z);
-                std::unique_ptr<mc::IVolumeSampler> greeble = _greebleSource->evaluate(sample, local);
-                if (greeble) {
-                    chunk->getVolume()->add(std::move(greeble));
-                }
-            }
-        }
+        chunk->updateGreebling(*_greebleSource);
     }
 }
 
-void TerrainGrid::marchSerially()
+void TerrainGrid::marchDirtyChunks()
 {
-    _dirtyChunks.back()->march([this]() {
+    // start the highest priority chunks, up to the in-flight limit; completion
+    // callbacks run on the main thread, as does this
+    while (!_dirtyChunks.empty() && _chunksInFlight < _maxChunksInFlight) {
+        auto chunk = _dirtyChunks.back();
         _dirtyChunks.pop_back();
-        if (!_dirtyChunks.empty()) {
-            marchSerially();
-        } else {
-            _isMarching = false;
-        }
-    });
+        _chunksInFlight++;
+
+        chunk->march([this, chunk]() {
+            storeInCache(chunk);
+            _chunksInFlight--;
+            if (_dirtyChunks.empty() && _chunksInFlight == 0) {
+                _isMarching = false;
+            } else {
+                marchDirtyChunks();
+            }
+        });
+    }
 }
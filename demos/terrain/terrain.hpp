@@ -1,12 +1,14 @@
 #ifndef terrain_segment_hpp
 #define terrain_segment_hpp
 
+#include <array>
 #include <chrono>
 #include <iostream>
 #include <map>
 #include <string>
 #include <vector>
 
+#include <mc/gpu_triangle_consumer.hpp>
 #include <mc/marching_cubes.hpp>
 #include <mc/util/util.hpp>
 #include <mc/volume.hpp>
@@ -14,46 +16,18 @@
 
 #include "../common/xorshift.hpp"
 #include "FastNoise.h"
+#include "chunk_disk_cache.hpp"
+#include "chunk_mesh_cache.hpp"
 #include "terrain_samplers.hpp"
 
-// Represents a source of "greeble" detail for a TerrainGrid. For example, this could be
-// used to add boulders, trees, etc to a TerrainGrid. Note: the added details should be small,
-// relative to the terrain.
-class GreebleSource {
-public:
-
-    // Represents a sample point in space with pseudorandom values.
-    // The GreebleSource must return identical value for a point in space.
-    struct Sample {
-        // Probability of a greeble detail being added.
-        float probability;
-        // A small positional offset to reduce appearance of grid sampling.
-        glm::vec3 offset;
-        // A seed for an RNG.
-        uint64_t seed;
-    };
-
-public:
-    GreebleSource() = default;
-    virtual ~GreebleSource() = default;
-    virtual int sampleStepSize() const = 0;
-    // Return a Sample struct for this point in world space. The Sample struct should be fairly random,
-    // but repeated calls to sample() for the same point in space must always return the same value.
-    virtual Sample sample(const vec3 world) const = 0;
-
-    // Evaluate a sample, and optionally return a volume sampler to add detail to the Terain.
-    // sample: The Sample to evaluate for possibly creating a greeble detail.
-    // local: The local coordinate system for the OctreeVolume the greeble detail will be added to.
-    // Return an IVolumeSampler to render greeble detail, or null if no detail should be added.
-    virtual std::unique_ptr<mc::IVolumeSampler> evaluate(const Sample& sample, const vec3& local) const = 0;
-};
-
 struct TerrainChunk {
 public:
     /**
      * Create a cube of terrain, where size is the size of an edge of the cube.
+     * The chunk is marched on threadPool, which may be shared with other chunks.
      */
-    TerrainChunk(int size, mc::util::unowned_ptr<TerrainSampler::SampleSource> terrain);
+    TerrainChunk(int size, mc::util::unowned_ptr<TerrainSampler::SampleSource> terrain,
+        mc::util::unowned_ptr<mc::util::ThreadPool> threadPool);
 
     ~TerrainChunk() = default;
     TerrainChunk(const TerrainChunk&) = delete;
@@ -67,6 +41,30 @@ public:
     // Get the index, where the "origin" terrain chunk has an index of (0,0)
     glm::ivec2 getIndex() const { return _index; }
 
+    /**
+     * Set the level of detail this chunk is marched at. Level 0 is full resolution, and each
+     * level above doubles the voxel stride, marching 1/8th as many cells. neighborLods are the
+     * levels of the adjoining chunks on -x, +x, -z & +z (-1 for none); faces bordering a coarser
+     * chunk are stitched to it. Changing either marks the chunk as needing to be re-marched.
+     * Must not be called while isWorking().
+     */
+    void setLod(int lod, const std::array<int, 4>& neighborLods);
+    int getLod() const { return _lod; }
+
+    // Packs the levels of the coarser neighbors this chunk is stitched to, 4 bits per face.
+    int getStitching() const;
+
+    /**
+     * When enabled, the chunk's volume coarsens the stride of octree nodes whose surface is
+     * flat or smooth (see mc::OctreeVolume::setAdaptiveMarching). Changing it marks the chunk
+     * as needing to be re-marched. Must not be called while isWorking().
+     */
+    void setAdaptiveMarching(bool adaptive);
+    bool isAdaptiveMarching() const { return _volume->isAdaptiveMarching(); }
+
+    // Replaces the greeble samplers previously added to this chunk with those produced by greebleSource.
+    void updateGreebling(const GreebleSource& greebleSource);
+
     // Returns true of the contents of this TerrainChunk have changed, and it needs to be re-marched.
     bool needsMarch() const { return _needsMarch; }
 
@@ -75,6 +73,26 @@ public:
      */
     void march(std::function<void()> onComplete);
 
+    /**
+     * Replaces this chunk's geometry with a previously marched copy from packGeometry(),
+     * e.g., from a ChunkMeshCache, rather than marching. The volume's nodes are still
+     * marked, for raycasting.
+     */
+    void restoreGeometry(const mc::TriangleConsumer<mc::PackedVertex>& geometry);
+
+    /**
+     * As above, but unpacks the mesh's vertices straight from the memory-mapped file.
+     */
+    void restoreGeometry(const ChunkDiskCache::MappedMesh& mesh);
+
+    /**
+     * Returns a copy of the geometry produced by the last march, packed against getPackBounds()
+     */
+    std::unique_ptr<mc::TriangleConsumer<mc::PackedVertex>> packGeometry() const;
+
+    // Bounds of the chunk's geometry in its volume's space; packGeometry() packs against them
+    mc::util::AABB getPackBounds() const { return _volume->getBounds(); }
+
     /**
      * Returns true if this segment is busy (generating heightmap, or marching the corresponding volume)
      */
@@ -82,8 +100,9 @@ public:
 
     mc::util::AABB getBounds() const { return _bounds; }
     mc::util::unowned_ptr<mc::OctreeVolume> getVolume() const { return _volume.get(); }
-    const std::vector<std::unique_ptr<mc::TriangleConsumer<mc::Vertex>>>& getGeometry() const { return _triangles; }
+    const std::vector<std::unique_ptr<mc::GpuTriangleConsumer<mc::Vertex>>>& getGeometry() const { return _triangles; }
     mc::util::LineSegmentBuffer& getAabbLineBuffer() { return _aabbLineBuffer; }
+    const std::vector<mc::OctreeVolume::Node*>& getMarchedNodes() const { return _marchedNodes; }
     mc::util::LineSegmentBuffer& getBoundingLineBuffer() { return _boundingLineBuffer; }
     double getLastMarchDurationSeconds() const { return _lastMarchDurationSeconds; }
     glm::vec3 getWorldOrigin() const { return glm::vec3(_index.x * _size, 0, _index.y * _size); }
@@ -93,13 +112,16 @@ private:
 
     glm::ivec2 _index;
     int _size = 0;
+    int _lod = 0;
+    std::array<int, 4> _neighborLods { -1, -1, -1, -1 };
     float _maxHeight = 0;
-    mc::util::ThreadPool _threadPool;
     mc::util::AABB _bounds;
     mc::util::unowned_ptr<TerrainSampler::SampleSource> _terrainSampleSource;
     std::unique_ptr<mc::OctreeVolume> _volume;
     mc::util::unowned_ptr<TerrainSampler> _groundSampler;
-    std::vector<std::unique_ptr<mc::TriangleConsumer<mc::Vertex>>> _triangles;
+    std::vector<mc::util::unowned_ptr<mc::IVolumeSampler>> _greebles;
+    std::vector<std::unique_ptr<mc::GpuTriangleConsumer<mc::Vertex>>> _triangles;
+    std::vector<mc::OctreeVolume::Node*> _marchedNodes;
     mc::util::LineSegmentBuffer _aabbLineBuffer;
     mc::util::LineSegmentBuffer _boundingLineBuffer;
     double _lastMarchDurationSeconds = 0;
@@ -166,6 +188,48 @@ public:
     // and those viewDir is facing.
     void march(const glm::vec3& viewPos, const glm::vec3& viewDir);
 
+    /**
+     * Set the max number of TerrainChunks march() will have in flight at once. Chunks
+     * are started in priority order as earlier ones complete, and their nodes share
+     * the grid's thread pool. A value of 1 marches chunks serially.
+     */
+    void setMaxChunksInFlight(int maxChunksInFlight) { _maxChunksInFlight = std::max(maxChunksInFlight, 1); }
+    int getMaxChunksInFlight() const { return _maxChunksInFlight; }
+
+    /**
+     * Chunks are assigned a level of detail by their ring distance from the center chunk;
+     * each ringsPerLod rings out from the center, the level increases by one, up to kMaxLod.
+     * march() re-marches chunks whose ring, and thereby level, changed, and chunks whose
+     * neighbors' levels changed, since they're stitched to coarser neighbors. A value of 0
+     * (the default) marches every chunk at full resolution.
+     */
+    void setLodRingsPerLevel(int ringsPerLod) { _lodRingsPerLevel = std::max(ringsPerLod, 0); }
+    int getLodRingsPerLevel() const { return _lodRingsPerLevel; }
+
+    // highest level of detail assigned, a voxel stride of 4
+    static constexpr int kMaxLod = 2;
+
+    /**
+     * When enabled, chunks march flat or smooth stretches of terrain with cells coarser
+     * than their level of detail calls for, refining only where the surface has detail.
+     * Must not be called while isMarching().
+     */
+    void setAdaptiveMarching(bool adaptive);
+    bool isAdaptiveMarching() const { return _adaptiveMarching; }
+
+    /**
+     * Meshes of marched chunks are cached, so a chunk recycled by shift() back to an
+     * index marched before is restored rather than re-marched.
+     */
+    ChunkMeshCache& getMeshCache() { return _meshCache; }
+
+    /**
+     * Set a cache which persists marched chunk meshes across runs. Chunks missing from
+     * the in-memory mesh cache are loaded from it, and marched chunks are written to it.
+     * Only used when the terrain sample source provides an identity().
+     */
+    void setDiskCache(std::unique_ptr<ChunkDiskCache>&& diskCache) { _diskCache = std::move(diskCache); }
+
     int getGridSize() const { return _gridSize; }
     glm::vec3 getChunkSize() const { return glm::vec3(_chunkSize); }
     int getCount() const { return _gridSize * _gridSize; }
@@ -205,18 +269,35 @@ private:
      */
     bool samplerIntersects(mc::IVolumeSampler* sampler, const vec3& samplerChunkWorldOrigin, const AABB worldBounds);
 
+    ChunkMeshCache::Key meshCacheKey(const TerrainChunk* chunk) const;
+    uint64_t diskCacheIdentity(const TerrainChunk* chunk) const;
+    bool restoreFromCache(TerrainChunk* chunk);
+    void storeInCache(TerrainChunk* chunk);
+    void updateLevelsOfDetail();
     void updateGreebling();
-    void marchSerially();
+    void marchDirtyChunks();
 
 private:
     int _gridSize = 0;
     int _chunkSize = 0;
     int _centerOffset = 0;
     bool _isMarching = false;
+    int _maxChunksInFlight = 1;
+    int _chunksInFlight = 0;
+    int _lodRingsPerLevel = 0;
+    bool _adaptiveMarching = false;
     std::vector<std::unique_ptr<TerrainChunk>> _grid;
     std::vector<TerrainChunk*> _dirtyChunks;
     std::unique_ptr<TerrainSampler::SampleSource> _terrainSampleSource;
     std::unique_ptr<GreebleSource> _greebleSource;
+
+    // shared by all chunks; declared after _grid so it's destroyed (and its
+    // threads joined) before the chunks its jobs reference
+    mc::util::ThreadPool _threadPool;
+
+    static constexpr std::size_t kDefaultMeshCacheBudgetBytes = 256 * 1024 * 1024;
+    ChunkMeshCache _meshCache;
+    std::unique_ptr<ChunkDiskCache> _diskCache;
 };
 
 #endif
\ No newline at end of file
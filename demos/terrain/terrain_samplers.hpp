@@ -1,10 +1,10 @@
 #ifndef terrain_samplers_hpp
 #define terrain_samplers_hpp
 
+#include <cstdint>
 #include <memory>
 
-#include <epoxy/gl.h>
-
+#include <mc/util/simd.hpp>
 #include <mc/util/unowned_ptr.hpp>
 #include <mc/volume.hpp>
 #include <mc/volume_samplers.hpp>
@@ -30,6 +30,11 @@ public:
         virtual ~SampleSource() = default;
         virtual float maxHeight() const = 0;
         virtual float sample(const vec3& world, mc::MaterialState& material) const = 0;
+
+        // Returns a value identifying the terrain this source generates which is stable
+        // across runs (e.g., derived from noise seeds), or 0 if there is none. Used to
+        // key persistent caches of marched terrain.
+        virtual uint64_t identity() const { return 0; }
     };
 
 public:
@@ -261,6 +266,82 @@ public:
         return totalContribution;
     }
 
+    void valuesAt(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float fuzziness, float* values, mc::MaterialState* materials) const override
+    {
+        using mc::util::simd::floatv;
+        using mc::util::simd::dot;
+        using mc::util::simd::select;
+
+        const float outerRadiusInner = _outerRadius - fuzziness;
+        const float innerRadiusInner = _innerRadius + fuzziness;
+        const floatv outerRadiusInner2 = outerRadiusInner * outerRadiusInner;
+        const floatv innerRadiusInner2 = innerRadiusInner * innerRadiusInner;
+        const vec3 innerAxisOrigin = _tubeAxisOrigin + _innerRadiusOffset;
+
+        std::size_t i = 0;
+        for (; i + floatv::width <= n; i += floatv::width) {
+            const floatv px = floatv::load(xs + i);
+            const floatv py = floatv::load(ys + i);
+            const floatv pz = floatv::load(zs + i);
+
+            const floatv frontFaceDist = dot(_frontFaceNormal.x, _frontFaceNormal.y, _frontFaceNormal.z,
+                px - _frontFaceOrigin.x, py - _frontFaceOrigin.y, pz - _frontFaceOrigin.z);
+            const floatv backFaceDist = dot(_backFaceNormal.x, _backFaceNormal.y, _backFaceNormal.z,
+                px - _backFaceOrigin.x, py - _backFaceOrigin.y, pz - _backFaceOrigin.z);
+
+            // closest point on outer cylinder axis, and squared distance to it
+            const floatv t = -dot(_tubeAxisOrigin.x - px, _tubeAxisOrigin.y - py, _tubeAxisOrigin.z - pz,
+                _tubeAxisDir.x, _tubeAxisDir.y, _tubeAxisDir.z);
+            const floatv toAxisX = px - (_tubeAxisOrigin.x + t * _tubeAxisDir.x);
+            const floatv toAxisY = py - (_tubeAxisOrigin.y + t * _tubeAxisDir.y);
+            const floatv toAxisZ = pz - (_tubeAxisOrigin.z + t * _tubeAxisDir.z);
+            const floatv distanceToOuterCylinderAxis2 = dot(toAxisX, toAxisY, toAxisZ, toAxisX, toAxisY, toAxisZ);
+
+            floatv distanceToInnerCylinderAxis2 = distanceToOuterCylinderAxis2;
+            if (_hasInnerCylinderOffset) {
+                const floatv ti = -dot(innerAxisOrigin.x - px, innerAxisOrigin.y - py, innerAxisOrigin.z - pz,
+                    _tubeAxisDir.x, _tubeAxisDir.y, _tubeAxisDir.z);
+                const floatv dx = px - (innerAxisOrigin.x + ti * _tubeAxisDir.x);
+                const floatv dy = py - (innerAxisOrigin.y + ti * _tubeAxisDir.y);
+                const floatv dz = pz - (innerAxisOrigin.z + ti * _tubeAxisDir.z);
+                distanceToInnerCylinderAxis2 = dot(dx, dy, dz, dx, dy, dz);
+            }
+
+            const floatv outside = (frontFaceDist > 0.0F) | (backFaceDist > 0.0F)
+                | (distanceToOuterCylinderAxis2 > _outerRadius2) | (distanceToInnerCylinderAxis2 < _innerRadius2);
+
+            const floatv frontFaceContribution = mc::util::simd::min(-frontFaceDist / fuzziness, 1.0F);
+            const floatv backFaceContribution = mc::util::simd::min(-backFaceDist / fuzziness, 1.0F);
+
+            const floatv innerGradient = (mc::util::simd::sqrt(distanceToInnerCylinderAxis2) - _innerRadius) / fuzziness;
+            const floatv outerGradient = 1.0F - ((mc::util::simd::sqrt(distanceToOuterCylinderAxis2) - outerRadiusInner) / fuzziness);
+            const floatv tubeContribution = select(distanceToInnerCylinderAxis2 < innerRadiusInner2, innerGradient,
+                select(distanceToOuterCylinderAxis2 > outerRadiusInner2, outerGradient, 1.0F));
+
+            floatv totalContribution = frontFaceContribution * backFaceContribution * tubeContribution;
+
+            if (_cutAngleRadians > 0) {
+                const floatv invLength = 1.0F / mc::util::simd::sqrt(dot(toAxisX, toAxisY, toAxisZ, toAxisX, toAxisY, toAxisZ));
+                const floatv d = dot(_tubeAxisPerp.x, _tubeAxisPerp.y, _tubeAxisPerp.z,
+                    toAxisX * invLength, toAxisY * invLength, toAxisZ * invLength);
+                totalContribution = select(d > _cosCutAngle, 0.0F, totalContribution);
+            }
+
+            select(outside, 0.0F, totalContribution).store(values + i);
+            if (materials) {
+                for (int j = 0; j < floatv::width; j++) {
+                    materials[i + j] = _material;
+                }
+            }
+        }
+
+        mc::MaterialState unused;
+        for (; i < n; i++) {
+            values[i] = valueAt(vec3(xs[i], ys[i], zs[i]), fuzziness, materials ? materials[i] : unused);
+        }
+    }
+
 private:
     //http://mathworld.wolfram.com/Point-LineDistance3-Dimensional.html
     // vec3 a = _tubeAxisOrigin;
@@ -322,4 +403,72 @@ private:
     mc::MaterialState _material;
 };
 
+// Represents a source of "greeble" detail for a TerrainGrid. For example, this could be
+// used to add boulders, trees, etc to a TerrainGrid. Note: the added details should be small,
+// relative to the terrain.
+class GreebleSource {
+public:
+
+    // Represents a sample point in space with pseudorandom values.
+    // The GreebleSource must return identical value for a point in space.
+    struct Sample {
+        // Probability of a greeble detail being added.
+        float probability;
+        // A small positional offset to reduce appearance of grid sampling.
+        glm::vec3 offset;
+        // A seed for an RNG.
+        uint64_t seed;
+    };
+
+public:
+    GreebleSource() = default;
+    virtual ~GreebleSource() = default;
+    virtual int sampleStepSize() const = 0;
+    // Returns a value identifying the greebles this source generates, as with TerrainSampler::SampleSource::identity.
+    virtual uint64_t identity() const { return 0; }
+    // Return a Sample struct for this point in world space. The Sample struct should be fairly random,
+    // but repeated calls to sample() for the same point in space must always return the same value.
+    virtual Sample sample(const vec3 world) const = 0;
+
+    // Evaluate a sample, and optionally return a volume sampler to add detail to the Terain.
+    // sample: The Sample to evaluate for possibly creating a greeble detail.
+    // local: The local coordinate system for the OctreeVolume the greeble detail will be added to.
+    // Return an IVolumeSampler to render greeble detail, or null if no detail should be added.
+    virtual std::unique_ptr<mc::IVolumeSampler> evaluate(const Sample& sample, const vec3& local) const = 0;
+
+    // Evaluate samples over the region around a chunk, adding any resulting greeble details to its volume.
+    // Neighboring chunks are sampled too, since their details may extend into this chunk.
+    // chunkBounds: The bounds of the chunk in world space.
+    // volume: The chunk's volume, in the chunk's local coordinate system.
+    // Returns the samplers added to volume.
+    std::vector<mc::util::unowned_ptr<mc::IVolumeSampler>> addGreebles(const AABB& chunkBounds, mc::BaseCompositeVolume& volume) const
+    {
+        std::vector<mc::util::unowned_ptr<mc::IVolumeSampler>> greebles;
+        const int step = sampleStepSize();
+        const auto snap = [step](float v) {
+            int x = v / step;
+            return static_cast<float>(x * step);
+        };
+
+        const auto extent = chunkBounds.size();
+        const auto range = AABB(
+            vec3(snap(chunkBounds.min.x - extent.x), chunkBounds.min.y, snap(chunkBounds.min.z - extent.z)),
+            vec3(snap(chunkBounds.max.x + extent.x), chunkBounds.max.y, snap(chunkBounds.max.z + extent.z)));
+
+        for (float x = range.min.x; x <= range.max.x; x += step) {
+            for (float z = range.min.z; z <= range.max.z; z += step) {
+                const vec3 world(x, 0, z);
+                const Sample s = sample(world);
+                const vec3 local(world.x - chunkBounds.min.x, 0, world.z - chunkBounds.min.z);
+                std::unique_ptr<mc::IVolumeSampler> greeble = evaluate(s, local);
+                if (greeble) {
+                    greebles.push_back(volume.add(std::move(greeble)));
+                }
+            }
+        }
+
+        return greebles;
+    }
+};
+
 #endif
\ No newline at end of file
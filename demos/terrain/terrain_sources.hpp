@@ -0,0 +1,191 @@
+#ifndef terrain_sources_hpp
+#define terrain_sources_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "../common/xorshift.hpp"
+#include "FastNoise.h"
+#include "terrain_samplers.hpp"
+
+// Terrain & greeble sources used by the terrain demo; kept free of any
+// GL dependency so they can be used headlessly, e.g. by mc_bench.
+
+//
+// Materials
+//
+
+const mc::MaterialState kFloorTerrainMaterial {
+    glm::vec4(1, 1, 1, 1),
+    0.3,
+    0,
+    0
+};
+
+const mc::MaterialState kLowTerrainMaterial {
+    glm::vec4(1, 1, 1, 1),
+    0,
+    1,
+    0
+};
+
+const mc::MaterialState kHighTerrainMaterial {
+    glm::vec4(1, 1, 1, 1),
+    0,
+    0,
+    1
+};
+
+const mc::MaterialState kArchMaterial {
+    glm::vec4(0.2, 0.2, 0.25, 1),
+    0.1,
+    0,
+    1
+};
+
+//
+// Sources
+//
+
+namespace terrain_sources_helpers {
+
+// FNV-1a hash of size bytes at data, continuing from hash
+inline uint64_t fnv1a(uint64_t hash, const void* data, std::size_t size)
+{
+    const auto bytes = static_cast<const uint8_t*>(data);
+    for (std::size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+template <typename T>
+uint64_t fnv1a(uint64_t hash, T value)
+{
+    return fnv1a(hash, &value, sizeof(T));
+}
+
+// Hash of the parameters which determine a FastNoise's output, salted by kind
+// so different sources sharing a FastNoise have different identities.
+inline uint64_t noiseIdentity(const FastNoise& noise, const char* kind)
+{
+    uint64_t hash = fnv1a(14695981039346656037ULL, kind, std::strlen(kind));
+    hash = fnv1a(hash, noise.GetSeed());
+    hash = fnv1a(hash, noise.GetFrequency());
+    hash = fnv1a(hash, static_cast<int>(noise.GetNoiseType()));
+    hash = fnv1a(hash, noise.GetFractalOctaves());
+    return hash;
+}
+
+}
+
+/**
+ * Rolling simplex-noise terrain with a flat floor at y = 0. Material blends
+ * from kFloorTerrainMaterial through kLowTerrainMaterial to kHighTerrainMaterial
+ * with height.
+ */
+class LumpyTerrainSource : public TerrainSampler::SampleSource {
+private:
+    FastNoise& _noise;
+    float _maxHeight;
+
+public:
+    LumpyTerrainSource(FastNoise& noise, float maxHeight)
+        : _noise(noise)
+        , _maxHeight(maxHeight)
+    {
+    }
+    float maxHeight() const override
+    {
+        return _maxHeight;
+    }
+    uint64_t identity() const override
+    {
+        using namespace terrain_sources_helpers;
+        return fnv1a(noiseIdentity(_noise, "LumpyTerrainSource"), _maxHeight);
+    }
+    float sample(const vec3& world, mc::MaterialState& material) const override
+    {
+        if (world.y < 1e-3F) {
+            material = kFloorTerrainMaterial;
+            return 1;
+        }
+
+        float noise2D = _noise.GetSimplex(world.x, world.z);
+        float noise3D = _noise.GetSimplex(world.x * 11, world.y * 11, world.z * 11);
+        float height = std::max(_maxHeight * noise2D, 0.0F);
+        float contribution = 0;
+        if (world.y < height) {
+            float a = (height - world.y) / height;
+            contribution = a * (a + 0.6F * noise3D);
+        }
+
+        float k = world.y / (0.5F * _maxHeight);
+        if (k < 0.1) {
+            material = mix(kFloorTerrainMaterial, kLowTerrainMaterial, k / 0.1F);
+        } else {
+            k = (k - 0.1F) / 0.9F;
+            material = mix(kLowTerrainMaterial, kHighTerrainMaterial, min(k, 1.0F));
+        }
+
+        return contribution;
+    }
+};
+
+/**
+ * Scatters pseudorandom arches (see Tube) across the terrain.
+ */
+class Greebler : public GreebleSource {
+private:
+    FastNoise& _noise;
+
+public:
+    Greebler(FastNoise& fn)
+        : _noise(fn)
+    {
+    }
+
+    int sampleStepSize() const override
+    {
+        return 15;
+    }
+
+    uint64_t identity() const override
+    {
+        return terrain_sources_helpers::noiseIdentity(_noise, "Greebler");
+    }
+
+    Sample sample(const vec3 world) const override
+    {
+        const float probability = (_noise.GetSimplex(world.x, world.z) + 1) * 0.5F; // map to [0,1]
+        const uint64_t seed = static_cast<uint64_t>(12345 + probability * 678910);
+        auto rng = rng_xorshift64 { seed };
+        const vec3 offset { rng.nextFloat(-5, 5), rng.nextFloat(-5, 5), rng.nextFloat(-5, 5) };
+        return Sample { probability, offset, seed };
+    }
+
+    std::unique_ptr<mc::IVolumeSampler> evaluate(const Sample& sample, const vec3& local) const override
+    {
+        if (sample.probability > 0.8) {
+            auto rng = rng_xorshift64 { sample.seed };
+            Tube::Config arch;
+            arch.axisOrigin = vec3 { local.x + sample.offset.x, 0, local.z + sample.offset.y };
+            arch.innerRadiusAxisOffset = vec3(0, rng.nextFloat(4, 10), 0);
+            arch.axisDir = normalize(vec3(rng.nextFloat(-1, 1), rng.nextFloat(-0.2, 0.2), rng.nextFloat(1, 1)));
+            arch.axisPerp = normalize(vec3(rng.nextFloat(-0.2, 0.2), 1, 0));
+            arch.length = rng.nextFloat(3, 7);
+            arch.innerRadius = rng.nextFloat(10, 15);
+            arch.outerRadius = rng.nextFloat(20, 35);
+            arch.frontFaceNormal = arch.axisDir;
+            arch.backFaceNormal = -arch.axisDir;
+            arch.cutAngleRadians = radians(rng.nextFloat(16, 32));
+            arch.material = kArchMaterial;
+            return std::make_unique<Tube>(arch);
+        }
+        return nullptr;
+    }
+};
+
+#endif
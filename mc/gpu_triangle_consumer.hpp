@@ -0,0 +1,90 @@
+#ifndef gpu_triangle_consumer_hpp
+#define gpu_triangle_consumer_hpp
+
+#include "triangle_consumer.hpp"
+#include "util/storage.hpp"
+
+namespace mc {
+
+/*
+ TriangleConsumer which uploads its vertices to a VBO on finish(),
+ and which can then be drawn. Requires a current GL context.
+    consumer.start();
+    ...
+    consumer.finish();
+
+    consumer.draw();
+ */
+template <class VertexType>
+class GpuTriangleConsumer : public TriangleConsumer<VertexType> {
+private:
+    util::VertexStorage<VertexType> _gpuStorage { GL_TRIANGLES };
+
+public:
+    GpuTriangleConsumer() = default;
+    ~GpuTriangleConsumer() override = default;
+
+    void finish() override
+    {
+        _gpuStorage.update(this->_vertices);
+    }
+
+    // Discards the consumed triangles, and uploads numVertices vertices (three per triangle)
+    // directly from memory to the VBO, without copying them into this consumer.
+    void upload(const VertexType* vertices, std::size_t numVertices)
+    {
+        TriangleConsumer<VertexType>::clear();
+        _gpuStorage.update(vertices, numVertices);
+    }
+
+    void draw() const
+    {
+        _gpuStorage.draw();
+    }
+
+    void clear() override
+    {
+        TriangleConsumer<VertexType>::clear();
+        _gpuStorage.update({});
+    }
+
+    const auto& getStorage() const { return _gpuStorage; }
+    auto& getStorage() { return _gpuStorage; }
+};
+
+/*
+ IndexedTriangleConsumer which uploads its vertices & indices to
+ GPU buffers on finish(), and which can then be drawn.
+ */
+template <class VertexType>
+class GpuIndexedTriangleConsumer : public IndexedTriangleConsumer<VertexType> {
+private:
+    util::IndexedVertexStorage<VertexType> _gpuStorage { GL_TRIANGLES };
+
+public:
+    GpuIndexedTriangleConsumer() = default;
+    ~GpuIndexedTriangleConsumer() override = default;
+
+    void finish() override
+    {
+        _gpuStorage.update(this->_vertices, this->_indices);
+    }
+
+    void draw() const
+    {
+        _gpuStorage.draw();
+    }
+
+    void clear() override
+    {
+        IndexedTriangleConsumer<VertexType>::clear();
+        _gpuStorage.update({}, {});
+    }
+
+    const auto& getStorage() const { return _gpuStorage; }
+    auto& getStorage() { return _gpuStorage; }
+};
+
+} // namespace mc
+
+#endif /* gpu_triangle_consumer_hpp */
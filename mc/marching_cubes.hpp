@@ -9,10 +9,15 @@
 #ifndef marching_cubes_hpp
 #define marching_cubes_hpp
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <functional>
+#include <unordered_map>
 
 #include "triangle_consumer.hpp"
-#include "util/util.hpp"
+#include "util/core.hpp"
+#include "util/simd.hpp"
 
 namespace mc {
 
@@ -53,7 +58,7 @@ struct Vertex {
     float texture0 { 0 };
     float texture1 { 0 };
 
-    enum class AttributeLayout : GLuint {
+    enum class AttributeLayout : unsigned int {
         Pos = 0,
         Color = 1,
         TriangleNormal = 2,
@@ -62,24 +67,424 @@ struct Vertex {
         Texture1 = 5
     };
 
+    // Defined by the GL layer (marching_cubes_gl.cpp); only needed for GPU upload
     static void bindVertexAttributes();
 };
 
+/*
+ Compact alternative to Vertex for storing large meshes on the CPU, e.g., in
+ caches or on disk; 20 bytes rather than 52. Fields start on 4 byte boundaries,
+ hence the reserved fields. The GL layer has no attribute binding or shader
+ which decodes it, so vertices must be unpack()ed to Vertex to be drawn.
+  pos: unorm16 across the bounds the vertex was packed against; unpack()
+    recovers the position as mix(bounds.min, bounds.max, pos)
+  triangleNormal: octahedral encoded as two snorm16
+  color: RGBA unorm8
+  shininess, texture0, texture1: unorm8
+ */
+struct PackedVertex {
+    uint16_t pos[3];
+    uint16_t reserved0 { 0 };
+    int16_t triangleNormal[2];
+    uint8_t color[4];
+    uint8_t shininess;
+    uint8_t texture0;
+    uint8_t texture1;
+    uint8_t reserved1 { 0 };
+
+    // Pack v, whose position lies in bounds
+    static PackedVertex pack(const Vertex& v, const util::AABB& bounds)
+    {
+        const auto unorm8 = [](float f) { return static_cast<uint8_t>(std::lround(glm::clamp(f, 0.0F, 1.0F) * 255)); };
+        const auto unorm16 = [](float f) { return static_cast<uint16_t>(std::lround(glm::clamp(f, 0.0F, 1.0F) * 65535)); };
+        const auto snorm16 = [](float f) { return static_cast<int16_t>(std::lround(glm::clamp(f, -1.0F, 1.0F) * 32767)); };
+
+        PackedVertex packed;
+        const auto pos = (v.pos - bounds.min) / glm::max(bounds.size(), glm::vec3(1e-6F));
+        for (int i = 0; i < 3; i++) {
+            packed.pos[i] = unorm16(pos[i]);
+        }
+
+        // project onto the octahedron |x| + |y| + |z| = 1, folding the lower half over the upper
+        const auto& n = v.triangleNormal;
+        const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+        glm::vec2 oct = l1 > 0 ? glm::vec2(n.x, n.y) / l1 : glm::vec2(0);
+        if (l1 > 0 && n.z < 0) {
+            oct = (1.0F - glm::abs(glm::vec2(oct.y, oct.x))) * glm::vec2(oct.x >= 0 ? 1 : -1, oct.y >= 0 ? 1 : -1);
+        }
+        packed.triangleNormal[0] = snorm16(oct.x);
+        packed.triangleNormal[1] = snorm16(oct.y);
+
+        for (int i = 0; i < 4; i++) {
+            packed.color[i] = unorm8(v.color[i]);
+        }
+        packed.shininess = unorm8(v.shininess);
+        packed.texture0 = unorm8(v.texture0);
+        packed.texture1 = unorm8(v.texture1);
+        return packed;
+    }
+
+    // Inverse of pack(), to within its quantization
+    Vertex unpack(const util::AABB& bounds) const
+    {
+        Vertex v;
+        v.pos = bounds.min + glm::vec3(pos[0], pos[1], pos[2]) / 65535.0F * bounds.size();
+
+        glm::vec3 n(triangleNormal[0] / 32767.0F, triangleNormal[1] / 32767.0F, 0);
+        n.z = 1.0F - std::abs(n.x) - std::abs(n.y);
+        if (n.z < 0) {
+            const glm::vec2 folded = (1.0F - glm::abs(glm::vec2(n.y, n.x))) * glm::vec2(n.x >= 0 ? 1 : -1, n.y >= 0 ? 1 : -1);
+            n.x = folded.x;
+            n.y = folded.y;
+        }
+        v.triangleNormal = glm::normalize(n);
+
+        v.color = glm::vec4(color[0], color[1], color[2], color[3]) / 255.0F;
+        v.shininess = shininess / 255.0F;
+        v.texture0 = texture0 / 255.0F;
+        v.texture1 = texture1 / 255.0F;
+        return v;
+    }
+};
+
+static_assert(sizeof(PackedVertex) == 20, "PackedVertex attributes should be tightly packed");
+
 //
 // Marching
 //
 
+struct MarchOptions {
+    // Spacing in voxels of the lattice the isosurface is sampled on; a stride
+    // of 2 marches cells 2 voxels on a side, sampling 1/8th as many points.
+    // When the region's size isn't a multiple of stride the last cell on each
+    // axis is clamped to the region's bounds.
+    int stride = 1;
+
+    // Lattice stride of the region across each face of the march region, indexed
+    // -x, +x, -y, +y, -z, +z; 0 when there's no neighbor. A face whose neighbor is
+    // marched at a coarser stride is stitched to it, so the meshes meet without cracks.
+    // Lattices are expected to be aligned to multiples of their stride.
+    int neighborStrides[6] = { 0, 0, 0, 0, 0, 0 };
+
+    // Lattice stride of the region diagonally across each edge of the march region;
+    // 0 when there's no neighbor. Edge e runs along axis e / 4, on the max side of the
+    // lower of the remaining two axes if (e & 2), and of the higher if (e & 1). Where a
+    // coarser region shares only an edge, it's stitched to as a face would be.
+    int edgeNeighborStrides[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+    // When > 0, march() tracks the surface rather than visiting every cell, so its
+    // cost follows the surface's area rather than the region's volume: seed cells
+    // are found probing the lattice on the region's faces, and a coarser lattice
+    // seedSpacing cells apart through its interior, and the surface is followed
+    // from them across the cell faces it crosses. Surface features which don't reach
+    // the region's faces and fit between the coarse lattice's points are missed.
+    // Regions less than a few seedSpacings across are marched cell by cell.
+    // Ignored by surfaceNets().
+    int seedSpacing = 0;
+
+    // When true, each vertex's triangleNormal receives the normal of the field's gradient
+    // rather than its triangle's flat normal; where the gradient vanishes, the vertex keeps
+    // its triangle's normal. Gradients are central differences of the lattice values march()
+    // samples anyway; at the region's faces the points a stride outside it are sampled too,
+    // so regions sharing a face give the vertices on it the same normals. Surface tracking
+    // (see seedSpacing) samples the neighbors it needs. Ignored by surfaceNets().
+    bool smoothNormals = false;
+
+    bool operator==(const MarchOptions& other) const
+    {
+        return stride == other.stride
+            && seedSpacing == other.seedSpacing
+            && smoothNormals == other.smoothNormals
+            && std::equal(neighborStrides, neighborStrides + 6, other.neighborStrides)
+            && std::equal(edgeNeighborStrides, edgeNeighborStrides + 12, other.edgeNeighborStrides);
+    }
+
+    bool operator!=(const MarchOptions& other) const { return !(*this == other); }
+};
+
+/*
+ The algorithms which can extract the isosurface of a region
+ MarchingCubes: Paul Bourke's table driven marching cubes; see march()
+ SurfaceNets: Naive Surface Nets, one vertex per cell; see surfaceNets()
+ */
+enum class Extractor {
+    MarchingCubes,
+    SurfaceNets
+};
+
 /*
  March region of a volume passing generated triangles into triangleConsumer
  region: The subregion to march
  valueSampler: source of isosurface values
- normalSampler: if provided, will be used to compute per-vertex surface normals. if null,
-    each vertex will receive the normal of the triangle it is a part of
  triangleConsumer: Receives each generated triangle
+ options: Lattice resolution, etc
  */
 void march(util::iAABB region,
     IsoSurfaceValueFunction valueSampler,
-    TriangleConsumer<Vertex>& triangleConsumer);
+    TriangleConsumer<Vertex>& triangleConsumer,
+    const MarchOptions& options = MarchOptions {});
+
+/*
+ Indexed variant of march(). Vertices on lattice edges shared by neighboring cells
+ are emitted once and referenced by index. Each vertex's triangleNormal receives the
+ normalized, area-weighted average of the normals of the triangles which share it.
+ region: The subregion to march
+ valueSampler: source of isosurface values
+ triangleConsumer: Receives the generated vertices and triangle indices
+ options: Lattice resolution, etc
+ */
+void march(util::iAABB region,
+    IsoSurfaceValueFunction valueSampler,
+    IndexedTriangleConsumer<Vertex>& triangleConsumer,
+    const MarchOptions& options = MarchOptions {});
+
+/*
+ Extract the isosurface of region with Naive Surface Nets, which shares each vertex
+ between the (up to 12) triangles around it, and produces none of the sliver
+ triangles march() does. Each region also samples the cells one stride beyond its min faces,
+ so regions which share a face meet without cracks. options.neighborStrides and
+ edgeNeighborStrides are ignored; regions marched at differing strides aren't stitched.
+ region: The subregion to extract
+ valueSampler: source of isosurface values
+ triangleConsumer: Receives each generated triangle
+ options: Lattice resolution
+ */
+void surfaceNets(util::iAABB region,
+    IsoSurfaceValueFunction valueSampler,
+    TriangleConsumer<Vertex>& triangleConsumer,
+    const MarchOptions& options = MarchOptions {});
+
+/*
+ Indexed variant of surfaceNets(). Each vertex is emitted once, and its triangleNormal
+ receives the normalized, area-weighted average of the normals of its triangles.
+ */
+void surfaceNets(util::iAABB region,
+    IsoSurfaceValueFunction valueSampler,
+    IndexedTriangleConsumer<Vertex>& triangleConsumer,
+    const MarchOptions& options = MarchOptions {});
+
+}
+
+#include "marching_cubes_detail.hpp"
+
+namespace mc {
+
+/*
+ Templated variants of march() which call valueSampler directly rather than through
+ an IsoSurfaceValueFunction, letting the compiler inline the sampler into the march
+ loop. ValueSampler must be callable as:
+    float valueSampler(const glm::vec3& p, MaterialState& material) const
+ Prefer these when the sampler's concrete type is known at the call site.
+ If ValueSampler is additionally callable as:
+    void valueSampler(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float* values, MaterialState* materials) const
+ each z-plane of the lattice is sampled with a single batched call, with
+ materials initialized to a default MaterialState. If ValueSampler offers:
+    float valueSampler.distanceBound(const glm::vec3& p) const
+ returning a distance within which the value & material don't change from those
+ at p, tiles of each z-plane lying within that distance are sampled just once.
+ */
+template <class ValueSampler>
+void march(util::iAABB region,
+    const ValueSampler& valueSampler,
+    TriangleConsumer<Vertex>& triangleConsumer,
+    const MarchOptions& options = MarchOptions {})
+{
+    detail::March(region, valueSampler, options, [&triangleConsumer](const Triangle<Vertex>& triangle) {
+        triangleConsumer.addTriangle(triangle);
+    });
+}
+
+/*
+ Variant of the templated march() appending to a SharedTriangleSink's writer, so
+ several threads can march straight into one TriangleConsumer.
+ */
+template <class ValueSampler>
+void march(util::iAABB region,
+    const ValueSampler& valueSampler,
+    SharedTriangleSink<Vertex>::Writer& writer,
+    const MarchOptions& options = MarchOptions {})
+{
+    detail::March(region, valueSampler, options, [&writer](const Triangle<Vertex>& triangle) {
+        writer.addTriangle(triangle);
+    });
+}
+
+template <class ValueSampler>
+void march(util::iAABB region,
+    const ValueSampler& valueSampler,
+    IndexedTriangleConsumer<Vertex>& triangleConsumer,
+    const MarchOptions& options = MarchOptions {})
+{
+    if (region.max.x <= region.min.x || region.max.y <= region.min.y || region.max.z <= region.min.z) {
+        return;
+    }
+
+    constexpr float IsoLevel = 0.5F;
+    const auto firstVertex = static_cast<uint32_t>(triangleConsumer.getNumVertices());
+    const auto firstIndex = triangleConsumer.getIndices().size();
+
+    const detail::Lattice lattice(region, options.stride);
+    const detail::TransitionFaces<ValueSampler> transitions(region, options, valueSampler, IsoLevel);
+    const auto cells = lattice.cells();
+
+    if (detail::TracksSurface(lattice, options.seedSpacing)) {
+        // cells are visited in no particular order, so their edges' vertices are keyed
+        // by the lattice index of the edge's minimal end and the axis it runs along
+        std::unordered_map<std::size_t, uint32_t> edgeVertices;
+        detail::SurfaceTracker<ValueSampler> tracker(lattice, valueSampler, transitions, IsoLevel, options.smoothNormals);
+        tracker.track(options.seedSpacing, [&](const detail::GridCell& cell, int x, int y, int z) {
+            detail::PolygoniseIndexed(
+                cell, IsoLevel, [&](const detail::EdgeInfo& edge) -> uint32_t& {
+                    const auto point = (static_cast<std::size_t>(z + edge.plane) * (cells.y + 1) + y + edge.dy) * (cells.x + 1) + x + edge.dx;
+                    return edgeVertices.emplace(point * 3 + edge.axis, detail::kNoVertex).first->second;
+                },
+                triangleConsumer);
+        });
+    } else {
+        detail::EdgeCache edgeCache;
+        edgeCache.reset(lattice);
+        detail::MarchLattice(
+            lattice, valueSampler, transitions, options.smoothNormals, IsoLevel,
+            [&](const detail::GridCell& cell, int x, int y, int) {
+                detail::PolygoniseIndexed(
+                    cell, IsoLevel, [&](const detail::EdgeInfo& edge) -> uint32_t& {
+                        return edgeCache.at(edge, x, y);
+                    },
+                    triangleConsumer);
+            },
+            [&](int) { edgeCache.advance(); });
+    }
+
+    // with smooth normals, vertices where the gradient vanished have no normal; as when
+    // not smoothing, they take the area weighted normal of the triangles sharing them
+    const auto N = static_cast<uint32_t>(triangleConsumer.getNumVertices());
+    if (options.smoothNormals) {
+        std::vector<uint8_t> flat(N - firstVertex);
+        bool anyFlat = false;
+        for (auto i = firstVertex; i < N; i++) {
+            flat[i - firstVertex] = triangleConsumer.getVertex(i).triangleNormal == glm::vec3(0);
+            anyFlat = anyFlat || flat[i - firstVertex];
+        }
+
+        const auto& indices = triangleConsumer.getIndices();
+        for (auto t = firstIndex, end = indices.size(); anyFlat && t < end; t += 3) {
+            const auto& va = triangleConsumer.getVertex(indices[t]);
+            const auto& vb = triangleConsumer.getVertex(indices[t + 1]);
+            const auto& vc = triangleConsumer.getVertex(indices[t + 2]);
+            const glm::vec3 n = glm::cross(vb.pos - va.pos, vc.pos - va.pos);
+            for (int c = 0; c < 3; c++) {
+                if (flat[indices[t + c] - firstVertex]) {
+                    triangleConsumer.getVertex(indices[t + c]).triangleNormal += n;
+                }
+            }
+        }
+    }
+
+    // normalize the accumulated face normals of the vertices we generated; vertices
+    // on transition faces are snapped after their normals were accumulated, but they
+    // move by less than a cell
+    for (auto i = firstVertex; i < N; i++) {
+        auto& v = triangleConsumer.getVertex(i);
+        if (transitions.active()) {
+            transitions.snap(v);
+        }
+        if (glm::length2(v.triangleNormal) > 0) {
+            v.triangleNormal = glm::normalize(v.triangleNormal);
+        } else {
+            v.triangleNormal = glm::vec3(0, 1, 0);
+        }
+    }
+}
+
+/*
+ Templated variants of surfaceNets(); see the templated march() for ValueSampler's requirements.
+ */
+template <class ValueSampler>
+void surfaceNets(util::iAABB region,
+    const ValueSampler& valueSampler,
+    TriangleConsumer<Vertex>& triangleConsumer,
+    const MarchOptions& options = MarchOptions {})
+{
+    if (region.max.x <= region.min.x || region.max.y <= region.min.y || region.max.z <= region.min.z) {
+        return;
+    }
+
+    constexpr float IsoLevel = 0.5F;
+    detail::SurfaceNetsTriangles(region, valueSampler, options.stride, IsoLevel, [&triangleConsumer](const Triangle<Vertex>& triangle) {
+        triangleConsumer.addTriangle(triangle);
+    });
+}
+
+/*
+ Variant of the templated surfaceNets() appending to a SharedTriangleSink's writer;
+ see the writer variant of march().
+ */
+template <class ValueSampler>
+void surfaceNets(util::iAABB region,
+    const ValueSampler& valueSampler,
+    SharedTriangleSink<Vertex>::Writer& writer,
+    const MarchOptions& options = MarchOptions {})
+{
+    if (region.max.x <= region.min.x || region.max.y <= region.min.y || region.max.z <= region.min.z) {
+        return;
+    }
+
+    constexpr float IsoLevel = 0.5F;
+    detail::SurfaceNetsTriangles(region, valueSampler, options.stride, IsoLevel, [&writer](const Triangle<Vertex>& triangle) {
+        writer.addTriangle(triangle);
+    });
+}
+
+template <class ValueSampler>
+void surfaceNets(util::iAABB region,
+    const ValueSampler& valueSampler,
+    IndexedTriangleConsumer<Vertex>& triangleConsumer,
+    const MarchOptions& options = MarchOptions {})
+{
+    if (region.max.x <= region.min.x || region.max.y <= region.min.y || region.max.z <= region.min.z) {
+        return;
+    }
+
+    constexpr float IsoLevel = 0.5F;
+    const auto firstVertex = static_cast<uint32_t>(triangleConsumer.getNumVertices());
+
+    detail::SurfaceNets(region, valueSampler, options.stride, IsoLevel, [&triangleConsumer](detail::SurfaceNetsLayer::Cell* corners[4]) {
+        // vertices are added when first referenced, so cells outside the region only
+        // contribute those their quads use
+        for (int i = 0; i < 4; i++) {
+            if (corners[i]->index == detail::kNoVertex) {
+                corners[i]->index = triangleConsumer.addVertex(corners[i]->vertex);
+            }
+        }
+
+        int triangles[2][3];
+        detail::TriangulateQuad(corners, triangles);
+        for (const auto& t : triangles) {
+            const uint32_t a = corners[t[0]]->index, b = corners[t[1]]->index, c = corners[t[2]]->index;
+
+            // area weighted face normal
+            auto& va = triangleConsumer.getVertex(a);
+            auto& vb = triangleConsumer.getVertex(b);
+            auto& vc = triangleConsumer.getVertex(c);
+            const glm::vec3 n = glm::cross(vb.pos - va.pos, vc.pos - va.pos);
+            va.triangleNormal += n;
+            vb.triangleNormal += n;
+            vc.triangleNormal += n;
+
+            triangleConsumer.addTriangle(a, b, c);
+        }
+    });
+
+    for (auto i = firstVertex, N = static_cast<uint32_t>(triangleConsumer.getNumVertices()); i < N; i++) {
+        auto& v = triangleConsumer.getVertex(i);
+        if (glm::length2(v.triangleNormal) > 0) {
+            v.triangleNormal = glm::normalize(v.triangleNormal);
+        } else {
+            v.triangleNormal = glm::vec3(0, 1, 0);
+        }
+    }
+}
 
 }
 
@@ -9,6 +9,17 @@
 #ifndef marching_cubes_detail_h
 #define marching_cubes_detail_h
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+// Note: included by marching_cubes.hpp once the types the march kernel operates on are declared
+
 namespace mc::detail {
 
 /*
@@ -16,7 +27,7 @@ From "Polygonising A Scalar Field" by Paul Bourke
 http://paulbourke.net/geometry/polygonise/
 */
 
-constexpr int kEdgeTable[256] = {
+inline constexpr int kEdgeTable[256] = {
     0x0, 0x109, 0x203, 0x30a, 0x406, 0x50f, 0x605, 0x70c,
     0x80c, 0x905, 0xa0f, 0xb06, 0xc0a, 0xd03, 0xe09, 0xf00,
     0x190, 0x99, 0x393, 0x29a, 0x596, 0x49f, 0x795, 0x69c,
@@ -51,7 +62,7 @@ constexpr int kEdgeTable[256] = {
     0x70c, 0x605, 0x50f, 0x406, 0x30a, 0x203, 0x109, 0x0
 };
 
-constexpr int kTriTable[256][16] = {
+inline constexpr int kTriTable[256][16] = {
     { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
     { 0, 8, 3, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
     { 0, 1, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
@@ -310,6 +321,1747 @@ constexpr int kTriTable[256][16] = {
     { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 }
 };
 
+
+/*
+From "Polygonising A Scalar Field" by Paul Bourke
+http://paulbourke.net/geometry/polygonise/
+*/
+
+//
+// GridCell
+//
+
+class GridCell {
+public:
+    glm::vec3 pos[8];
+    float val[8];
+    MaterialState material[8];
+    bool occupied;
+
+    // the field's gradient at each corner, when hasGradients
+    glm::vec3 gradient[8];
+    bool hasGradients;
+
+    GridCell()
+        : occupied(false)
+        , hasGradients(false)
+    {
+        for (int i = 0; i < 8; i++)
+            val[i] = 0;
+    }
+
+    GridCell(const GridCell& c) = delete;
+    GridCell& operator=(const GridCell& c) = delete;
+};
+
+//
+// MarchingCubes Implementation
+//
+
+/*
+Linearly interpolate the grid cell values where an isosurface cuts
+an edge between two positions, each with their own scalar value.
+Only edges the isosurface crosses are interpolated; one end lies below
+the isolevel and the other doesn't, so their values differ and the
+crossing lies on the edge, without special cases.
+When the cell has gradients, the vertex's triangleNormal receives the
+normal they give, or zero where the gradient vanishes.
+*/
+inline Vertex Lerp(float isolevel, const GridCell& cell, int idxA, int idxB)
+{
+    using glm::mix;
+
+    const float mu = (isolevel - cell.val[idxA]) / (cell.val[idxB] - cell.val[idxA]);
+
+    Vertex v;
+    v.pos = mix(cell.pos[idxA], cell.pos[idxB], mu);
+    v.color = mix(cell.material[idxA].color, cell.material[idxB].color, mu);
+    v.shininess = mix(cell.material[idxA].shininess, cell.material[idxB].shininess, mu);
+    v.texture0 = mix(cell.material[idxA].texture0, cell.material[idxB].texture0, mu);
+    v.texture1 = mix(cell.material[idxA].texture1, cell.material[idxB].texture1, mu);
+
+    if (cell.hasGradients) {
+        // values rise into the volume, so the outward normal opposes the gradient
+        const glm::vec3 gradient = mix(cell.gradient[idxA], cell.gradient[idxB], mu);
+        v.triangleNormal = glm::length2(gradient) > 0 ? -glm::normalize(gradient) : glm::vec3(0);
+    }
+
+    return v;
+}
+
+/*
+Determine the index into the edge table which
+tells us which vertices are inside of the surface
+*/
+inline int CubeIndex(const GridCell& cell, float isolevel)
+{
+    int cubeIndex = 0;
+    for (int i = 0; i < 8; i++) {
+        cubeIndex |= static_cast<int>(cell.val[i] < isolevel) << i;
+    }
+    return cubeIndex;
+}
+
+/*
+Given a grid cell and an isolevel, calculate the triangular
+facets required to represent the isosurface through the cell.
+Return the number of triangular facets, the array "triangles"
+will be loaded up with the vertices at most 5 triangular facets.
+0 will be returned if the grid cell is either totally above
+of totally below the isolevel.
+*/
+
+inline int Polygonise(const GridCell& cell, float isolevel, Triangle<Vertex>* triangles)
+{
+    const int cubeIndex = CubeIndex(cell, isolevel);
+
+    /*
+    Cube is entirely in/out of the surface
+    */
+    if (kEdgeTable[cubeIndex] == 0)
+        return 0;
+
+    /*
+    Find the vertices where the surface intersects the cube
+    */
+    Vertex vertices[12];
+
+    if (kEdgeTable[cubeIndex] & 1) {
+        vertices[0] = Lerp(isolevel, cell, 0, 1);
+    }
+
+    if (kEdgeTable[cubeIndex] & 2) {
+        vertices[1] = Lerp(isolevel, cell, 1, 2);
+    }
+
+    if (kEdgeTable[cubeIndex] & 4) {
+        vertices[2] = Lerp(isolevel, cell, 2, 3);
+    }
+
+    if (kEdgeTable[cubeIndex] & 8) {
+        vertices[3] = Lerp(isolevel, cell, 3, 0);
+    }
+
+    if (kEdgeTable[cubeIndex] & 16) {
+        vertices[4] = Lerp(isolevel, cell, 4, 5);
+    }
+
+    if (kEdgeTable[cubeIndex] & 32) {
+        vertices[5] = Lerp(isolevel, cell, 5, 6);
+    }
+
+    if (kEdgeTable[cubeIndex] & 64) {
+        vertices[6] = Lerp(isolevel, cell, 6, 7);
+    }
+
+    if (kEdgeTable[cubeIndex] & 128) {
+        vertices[7] = Lerp(isolevel, cell, 7, 4);
+    }
+
+    if (kEdgeTable[cubeIndex] & 256) {
+        vertices[8] = Lerp(isolevel, cell, 0, 4);
+    }
+
+    if (kEdgeTable[cubeIndex] & 512) {
+        vertices[9] = Lerp(isolevel, cell, 1, 5);
+    }
+
+    if (kEdgeTable[cubeIndex] & 1024) {
+        vertices[10] = Lerp(isolevel, cell, 2, 6);
+    }
+
+    if (kEdgeTable[cubeIndex] & 2048) {
+        vertices[11] = Lerp(isolevel, cell, 3, 7);
+    }
+
+    //
+    //    Create the triangle
+    //
+
+    int numTriangles = 0;
+    for (int i = 0; kTriTable[cubeIndex][i] != -1; i += 3) {
+        triangles[numTriangles].a = vertices[kTriTable[cubeIndex][i]];
+        triangles[numTriangles].b = vertices[kTriTable[cubeIndex][i + 1]];
+        triangles[numTriangles].c = vertices[kTriTable[cubeIndex][i + 2]];
+
+        // compute the normal of the triangle; with gradients, only
+        // vertices where the gradient vanishes take it
+        glm::vec3 n = normalize(cross(triangles[numTriangles].b.pos - triangles[numTriangles].a.pos, triangles[numTriangles].c.pos - triangles[numTriangles].a.pos));
+        for (auto v : { &triangles[numTriangles].a, &triangles[numTriangles].b, &triangles[numTriangles].c }) {
+            if (!cell.hasGradients || v->triangleNormal == glm::vec3(0)) {
+                v->triangleNormal = n;
+            }
+        }
+        numTriangles++;
+    }
+
+    return numTriangles;
+}
+
+//
+// Lattice
+//
+
+/*
+Maps the lattice indices of a march region to voxel coordinates. Lattice
+points are spaced stride voxels apart; when the region's size isn't a
+multiple of stride, the last point on each axis is clamped to region.max.
+*/
+class Lattice {
+public:
+    Lattice(const util::iAABB& region, int stride)
+        : _min(region.min)
+        , _max(region.max)
+        , _stride(std::max(stride, 1))
+        , _cells((region.max - region.min + _stride - 1) / _stride)
+    {
+    }
+
+    // number of cells along each axis
+    glm::ivec3 cells() const { return _cells; }
+
+    int x(int i) const { return std::min(_min.x + i * _stride, _max.x); }
+    int y(int j) const { return std::min(_min.y + j * _stride, _max.y); }
+    int z(int k) const { return std::min(_min.z + k * _stride, _max.z); }
+
+    // coordinate of lattice index n along axis (0:x, 1:y, 2:z)
+    int coordinate(int axis, int n) const { return axis == 0 ? x(n) : axis == 1 ? y(n) : z(n); }
+
+    int stride() const { return _stride; }
+
+private:
+    glm::ivec3 _min, _max;
+    int _stride;
+    glm::ivec3 _cells;
+};
+
+//
+// Slab
+//
+
+/*
+True when ValueSampler additionally offers a batched entry point:
+    void valueSampler(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float* values, MaterialState* materials) const
+*/
+template <class ValueSampler, class = void>
+struct IsBatchedValueSampler : std::false_type {
+};
+
+template <class ValueSampler>
+struct IsBatchedValueSampler<ValueSampler,
+    std::void_t<decltype(std::declval<const ValueSampler&>()(
+        std::declval<const float*>(), std::declval<const float*>(), std::declval<const float*>(),
+        std::declval<std::size_t>(), std::declval<float*>(), std::declval<MaterialState*>()))>>
+    : std::true_type {
+};
+
+/*
+True when ValueSampler additionally offers a conservative distance bound:
+    float valueSampler.distanceBound(const glm::vec3& p) const
+returning a distance within which every point has the same value and
+material as p.
+*/
+template <class ValueSampler, class = void>
+struct HasDistanceBound : std::false_type {
+};
+
+template <class ValueSampler>
+struct HasDistanceBound<ValueSampler,
+    std::void_t<decltype(std::declval<const ValueSampler&>().distanceBound(std::declval<const glm::vec3&>()))>>
+    : std::true_type {
+};
+
+/*
+Holds the isosurface value and material of each lattice point in a single
+z-plane of a march region. Adjacent cells share corners, so march() samples
+each plane once into a Slab and assembles GridCells from a pair of them,
+instead of evaluating the value function at all 8 corners of every cell.
+*/
+class Slab {
+public:
+    Slab() = default;
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    /*
+    Sample the lattice points of plane z (inclusive of the last lattice
+    point on x and y, since the cells along the max edges need them).
+    When the sampler offers a distance bound, a plane larger than a tile
+    is divided into tiles, and each tile lying within the bound of its
+    center is filled from a single sample rather than sampling each of
+    its points.
+    */
+    template <class ValueSampler>
+    void sample(const Lattice& lattice, int z, const ValueSampler& valueFunction)
+    {
+        _width = lattice.cells().x + 1;
+        const int height = lattice.cells().y + 1;
+        const std::size_t count = _width * height;
+        _values.resize(count);
+        _materials.resize(count);
+        _gradientsValid = false;
+
+        if constexpr (HasDistanceBound<ValueSampler>::value) {
+            // planes smaller than a tile belong to small octree nodes, which lie near the surface
+            if (_width > kTileSize && height > kTileSize && fillUniformTiles(lattice, z, valueFunction)) {
+                sampleUnfilled(lattice, z, valueFunction);
+                return;
+            }
+        }
+
+        if constexpr (IsBatchedValueSampler<ValueSampler>::value) {
+            // lay out the plane's coordinates and hand the whole plane to
+            // the sampler in one call; materials start from default state
+            // just as they do for a freshly constructed MaterialState
+            _xs.resize(count);
+            _ys.resize(count);
+            _zs.resize(count);
+            for (int j = 0, n = 0; j < height; j++) {
+                for (int i = 0; i < _width; i++, n++) {
+                    _xs[n] = static_cast<float>(lattice.x(i));
+                    _ys[n] = static_cast<float>(lattice.y(j));
+                    _zs[n] = static_cast<float>(z);
+                    _materials[n] = MaterialState {};
+                }
+            }
+            valueFunction(_xs.data(), _ys.data(), _zs.data(), count, _values.data(), _materials.data());
+        } else {
+            for (int j = 0, n = 0; j < height; j++) {
+                for (int i = 0; i < _width; i++, n++) {
+                    const glm::vec3 p(lattice.x(i), lattice.y(j), z);
+                    _values[n] = valueFunction(p, _materials[n]);
+                }
+            }
+        }
+    }
+
+    // value of the lattice point at index (i,j)
+    float value(int i, int j) const
+    {
+        return _values[j * _width + i];
+    }
+
+    const MaterialState& material(int i, int j) const
+    {
+        return _materials[j * _width + i];
+    }
+
+    void set(int i, int j, float value, const MaterialState& material)
+    {
+        _values[j * _width + i] = value;
+        _materials[j * _width + i] = material;
+    }
+
+    /*
+    Record which lattice points lie below isolevel, as rows of bits read by
+    belowRow(); call once the plane's values are final
+    */
+    void classify(float isolevel)
+    {
+        using util::simd::floatv;
+        static_assert(64 % floatv::width == 0, "a batch of points mustn't straddle words");
+
+        const int height = static_cast<int>(_values.size()) / _width;
+        _rowWords = (_width + 63) / 64;
+        _below.assign(static_cast<std::size_t>(_rowWords * height), 0);
+        const floatv iso = isolevel;
+        for (int j = 0; j < height; j++) {
+            const float* values = _values.data() + j * _width;
+            uint64_t* bits = _below.data() + j * _rowWords;
+            int i = 0;
+            for (; i + floatv::width <= _width; i += floatv::width) {
+                const auto mask = static_cast<uint64_t>(util::simd::movemask(floatv::load(values + i) < iso));
+                bits[i / 64] |= mask << (i % 64);
+            }
+            for (; i < _width; i++) {
+                bits[i / 64] |= static_cast<uint64_t>(values[i] < isolevel) << (i % 64);
+            }
+        }
+    }
+
+    /*
+    Row j of the classification made by classify(): bit i % 64 of word i / 64
+    is set if the point (i,j) lies below the isolevel. Bits past the row's
+    last point are clear.
+    */
+    const uint64_t* belowRow(int j) const
+    {
+        return _below.data() + j * _rowWords;
+    }
+
+    int rowWords() const { return _rowWords; }
+
+    /*
+    Gradient of the lattice point at index (i,j), as compute() returns it;
+    neighboring cells share their corners, so each is computed just once
+    after sample()
+    */
+    template <class Compute>
+    const glm::vec3& gradient(int i, int j, Compute&& compute)
+    {
+        if (!_gradientsValid) {
+            _gradients.assign(_values.size(), glm::vec3(std::numeric_limits<float>::quiet_NaN()));
+            _gradientsValid = true;
+        }
+
+        auto& gradient = _gradients[j * _width + i];
+        if (std::isnan(gradient.x)) {
+            gradient = compute();
+        }
+        return gradient;
+    }
+
+private:
+    static constexpr int kTileSize = 8;
+
+    /*
+    Fill each tile of the plane whose points all lie within the sampler's
+    distance bound of the tile's center with the value & material at the
+    center. Returns true if any tile was filled.
+    */
+    template <class ValueSampler>
+    bool fillUniformTiles(const Lattice& lattice, int z, const ValueSampler& valueFunction)
+    {
+        const int height = static_cast<int>(_values.size()) / _width;
+        const int tilesWide = (_width + kTileSize - 1) / kTileSize;
+        const int tilesHigh = (height + kTileSize - 1) / kTileSize;
+        _filledTiles.assign(tilesWide * tilesHigh, false);
+
+        bool filled = false;
+        for (int tj = 0; tj < tilesHigh; tj++) {
+            for (int ti = 0; ti < tilesWide; ti++) {
+                const int i0 = ti * kTileSize, i1 = std::min(i0 + kTileSize, _width) - 1;
+                const int j0 = tj * kTileSize, j1 = std::min(j0 + kTileSize, height) - 1;
+                const glm::vec2 min(lattice.x(i0), lattice.y(j0));
+                const glm::vec2 max(lattice.x(i1), lattice.y(j1));
+                const glm::vec2 mid = (min + max) * 0.5F;
+                const glm::vec3 center(mid.x, mid.y, z);
+                if (valueFunction.distanceBound(center) <= glm::length(max - min) * 0.5F) {
+                    continue;
+                }
+
+                MaterialState material;
+                const float value = valueFunction(center, material);
+                for (int j = j0; j <= j1; j++) {
+                    std::fill(_values.begin() + j * _width + i0, _values.begin() + j * _width + i1 + 1, value);
+                    std::fill(_materials.begin() + j * _width + i0, _materials.begin() + j * _width + i1 + 1, material);
+                }
+                _filledTiles[tj * tilesWide + ti] = true;
+                filled = true;
+            }
+        }
+
+        return filled;
+    }
+
+    // sample the points of the plane not filled by fillUniformTiles()
+    template <class ValueSampler>
+    void sampleUnfilled(const Lattice& lattice, int z, const ValueSampler& valueFunction)
+    {
+        const int height = static_cast<int>(_values.size()) / _width;
+        const int tilesWide = (_width + kTileSize - 1) / kTileSize;
+        const auto unfilled = [&](int i, int j) {
+            return !_filledTiles[(j / kTileSize) * tilesWide + i / kTileSize];
+        };
+
+        if constexpr (IsBatchedValueSampler<ValueSampler>::value) {
+            // gather the unfilled points, sample them in one call, and scatter the results
+            _indices.clear();
+            _xs.clear();
+            _ys.clear();
+            _zs.clear();
+            for (int j = 0; j < height; j++) {
+                for (int i = 0; i < _width; i++) {
+                    if (unfilled(i, j)) {
+                        _indices.push_back(j * _width + i);
+                        _xs.push_back(static_cast<float>(lattice.x(i)));
+                        _ys.push_back(static_cast<float>(lattice.y(j)));
+                        _zs.push_back(static_cast<float>(z));
+                    }
+                }
+            }
+
+            const std::size_t count = _indices.size();
+            _gatheredValues.resize(count);
+            _gatheredMaterials.assign(count, MaterialState {});
+            valueFunction(_xs.data(), _ys.data(), _zs.data(), count, _gatheredValues.data(), _gatheredMaterials.data());
+            for (std::size_t n = 0; n < count; n++) {
+                _values[_indices[n]] = _gatheredValues[n];
+                _materials[_indices[n]] = _gatheredMaterials[n];
+            }
+        } else {
+            for (int j = 0, n = 0; j < height; j++) {
+                for (int i = 0; i < _width; i++, n++) {
+                    if (unfilled(i, j)) {
+                        const glm::vec3 p(lattice.x(i), lattice.y(j), z);
+                        _values[n] = valueFunction(p, _materials[n]);
+                    }
+                }
+            }
+        }
+    }
+
+    int _width = 0;
+    std::vector<float> _values;
+    std::vector<MaterialState> _materials;
+    std::vector<glm::vec3> _gradients;
+    bool _gradientsValid = false;
+    int _rowWords = 0;
+    std::vector<uint64_t> _below;
+    std::vector<bool> _filledTiles;
+    std::vector<int> _indices;
+    std::vector<float> _gatheredValues;
+    std::vector<MaterialState> _gatheredMaterials;
+    std::vector<float> _xs, _ys, _zs;
+};
+
+//
+// GridCell Access
+//
+
+/*
+Populate the positions and values of the cell at lattice index (i,j,k) from
+the pre-sampled front (k) and back (k+1) slabs; see GetGridCellMaterials
+*/
+inline bool GetGridCell(int i, int j, int k, const Lattice& lattice, const Slab& front, const Slab& back, GridCell& cell)
+{
+    const float x0 = lattice.x(i), x1 = lattice.x(i + 1);
+    const float y0 = lattice.y(j), y1 = lattice.y(j + 1);
+    const float z0 = lattice.z(k), z1 = lattice.z(k + 1);
+
+    // store the location in the voxel array
+    cell.pos[0] = glm::vec3(x0, y0, z0);
+    cell.pos[1] = glm::vec3(x1, y0, z0);
+    cell.pos[2] = glm::vec3(x1, y1, z0);
+    cell.pos[3] = glm::vec3(x0, y1, z0);
+
+    cell.pos[4] = glm::vec3(x0, y0, z1);
+    cell.pos[5] = glm::vec3(x1, y0, z1);
+    cell.pos[6] = glm::vec3(x1, y1, z1);
+    cell.pos[7] = glm::vec3(x0, y1, z1);
+
+    // store the value in the voxel array
+    cell.val[0] = front.value(i, j);
+    cell.val[1] = front.value(i + 1, j);
+    cell.val[2] = front.value(i + 1, j + 1);
+    cell.val[3] = front.value(i, j + 1);
+
+    cell.val[4] = back.value(i, j);
+    cell.val[5] = back.value(i + 1, j);
+    cell.val[6] = back.value(i + 1, j + 1);
+    cell.val[7] = back.value(i, j + 1);
+
+    cell.occupied = (cell.val[0] > 0
+        || cell.val[1] > 0
+        || cell.val[2] > 0
+        || cell.val[3] > 0
+        || cell.val[4] > 0
+        || cell.val[5] > 0
+        || cell.val[6] > 0
+        || cell.val[7] > 0);
+
+    return cell.occupied;
+}
+
+/*
+Collect into active the x index of each cell in row j of the slab pair front
+& back which the isosurface crosses, i.e., whose corners lie on both sides of
+the isolevel, per Slab::classify(). Cells are classified 64 at a time from
+the bits of their corners, without branching per cell.
+*/
+inline void ActiveCells(const Lattice& lattice, int j, const Slab& front, const Slab& back, std::vector<int>& active)
+{
+    const int numCells = lattice.cells().x;
+    const int words = front.rowWords();
+    const uint64_t* rows[4] = { front.belowRow(j), front.belowRow(j + 1), back.belowRow(j), back.belowRow(j + 1) };
+
+    active.clear();
+    for (int w = 0; w * 64 < numCells; w++) {
+        uint64_t anyBelow = 0, allBelow = ~uint64_t(0);
+        for (const auto row : rows) {
+            // bit b of next is the corner at x + 1 of the cell at x = 64w + b
+            const uint64_t bits = row[w];
+            const uint64_t next = (bits >> 1) | (w + 1 < words ? row[w + 1] << 63 : 0);
+            anyBelow |= bits | next;
+            allBelow &= bits & next;
+        }
+
+        uint64_t crossed = anyBelow & ~allBelow;
+        const int remaining = numCells - w * 64;
+        if (remaining < 64) {
+            crossed &= (uint64_t(1) << remaining) - 1;
+        }
+
+        for (; crossed; crossed &= crossed - 1) {
+            active.push_back(w * 64 + util::CountTrailingZeros(crossed));
+        }
+    }
+}
+
+/*
+Gradient of the field at lattice point (i,j) of plane k, whose values slab holds;
+below and above hold planes k - 1 and k + 1, or are null beyond the lattice's
+min & max planes. Differences are central, one stride either side of the point;
+where there's no lattice point there, i.e., past the lattice's faces or short of
+a max face the lattice is clamped to, valueSampler is sampled instead. Regions
+sharing a face thereby compute the same gradients for the points on it.
+*/
+template <class ValueSampler>
+glm::vec3 LatticeGradient(int i, int j, int k, const Lattice& lattice, const ValueSampler& valueSampler,
+    const Slab* below, const Slab& slab, const Slab* above)
+{
+    const auto cells = lattice.cells();
+    const int stride = lattice.stride();
+    const glm::ivec3 index(i, j, k);
+    const glm::ivec3 p(lattice.x(i), lattice.y(j), lattice.z(k));
+
+    // value one stride from p along axis, in direction -1 or +1
+    const auto valueAt = [&](int axis, int direction) -> float {
+        const int n = index[axis] + direction;
+        const Slab* plane = axis < 2 ? &slab : direction < 0 ? below : above;
+        if (plane && n >= 0 && n <= cells[axis] && lattice.coordinate(axis, n) == p[axis] + direction * stride) {
+            return axis == 0 ? plane->value(n, j) : axis == 1 ? plane->value(i, n) : plane->value(i, j);
+        }
+
+        glm::ivec3 q = p;
+        q[axis] += direction * stride;
+        MaterialState _;
+        return valueSampler(glm::vec3(q), _);
+    };
+
+    glm::vec3 gradient;
+    for (int axis = 0; axis < 3; axis++) {
+        gradient[axis] = (valueAt(axis, 1) - valueAt(axis, -1)) / static_cast<float>(2 * stride);
+    }
+    return gradient;
+}
+
+/*
+Fill the gradients of cell (i,j,k), read by GetGridCell from front & back;
+below and above are the planes either side of those, as for LatticeGradient
+*/
+template <class ValueSampler>
+void GetGridCellGradients(int i, int j, int k, const Lattice& lattice, const ValueSampler& valueSampler,
+    const Slab* below, Slab& front, Slab& back, const Slab* above, GridCell& cell)
+{
+    const glm::ivec2 corners[4] = { { i, j }, { i + 1, j }, { i + 1, j + 1 }, { i, j + 1 } };
+    for (int n = 0; n < 4; n++) {
+        const auto c = corners[n];
+        cell.gradient[n] = front.gradient(c.x, c.y, [&]() {
+            return LatticeGradient(c.x, c.y, k, lattice, valueSampler, below, front, &back);
+        });
+        cell.gradient[n + 4] = back.gradient(c.x, c.y, [&]() {
+            return LatticeGradient(c.x, c.y, k + 1, lattice, valueSampler, &front, back, above);
+        });
+    }
+    cell.hasGradients = true;
+}
+
+//
+// Transition Faces
+//
+
+/*
+Stitches the faces and edges of a march region to neighbors marched at a
+coarser stride (see MarchOptions::neighborStrides & edgeNeighborStrides).
+Full Transvoxel transition cells aren't used; instead the fine side is made
+to agree with the coarse side's mesh:
+ - project() replaces the field on the face (or edge) with the bilinear (or
+   linear) interpolation of the coarse lattice, so vertices on coarse lattice
+   edges land exactly where the coarse neighbor puts them.
+ - snap() moves each remaining face vertex onto the contour segment the coarse
+   neighbor generates across that face cell, so no gap opens between them.
+   With MarchOptions::smoothNormals a snapped vertex keeps its gradient normal,
+   since it moves by less than a cell; otherwise its triangle's normal is
+   recomputed.
+*/
+template <class ValueSampler>
+class TransitionFaces {
+public:
+    TransitionFaces(const util::iAABB& region, const MarchOptions& options, const ValueSampler& valueSampler, float isolevel)
+        : _valueSampler(valueSampler)
+        , _isolevel(isolevel)
+        , _stride(std::max(options.stride, 1))
+        , _smoothNormals(options.smoothNormals)
+    {
+        for (int f = 0; f < 6; f++) {
+            const int axis = f / 2;
+            _faces[f].coordinate = static_cast<float>(f % 2 ? region.max[axis] : region.min[axis]);
+            _faces[f].stride = options.neighborStrides[f] > _stride ? options.neighborStrides[f] : 0;
+            _active = _active || _faces[f].stride > 0;
+        }
+
+        for (int e = 0; e < 12; e++) {
+            const auto axes = tangentAxes(e / 4);
+            _edges[e].coordinates = glm::vec2(
+                e & 2 ? region.max[axes.x] : region.min[axes.x],
+                e & 1 ? region.max[axes.y] : region.min[axes.y]);
+            _edges[e].stride = options.edgeNeighborStrides[e] > _stride ? options.edgeNeighborStrides[e] : 0;
+            _active = _active || _edges[e].stride > 0;
+        }
+    }
+
+    TransitionFaces(const TransitionFaces&) = delete;
+    TransitionFaces& operator=(const TransitionFaces&) = delete;
+
+    bool active() const { return _active; }
+
+    /*
+    The value & material project() would leave at p, whether or not p lies
+    on a transition face or edge
+    */
+    float projectedValueAt(const glm::vec3& p, MaterialState& material) const
+    {
+        return valueAt(p, _stride, material);
+    }
+
+    /*
+    Replace the value & material of each point of slab (sampled at plane z)
+    which lies on a transition face or edge.
+    */
+    void project(const Lattice& lattice, int z, Slab& slab) const
+    {
+        const auto cells = lattice.cells();
+        const auto projectPoint = [&](int i, int j) {
+            MaterialState material;
+            const float value = valueAt(glm::vec3(lattice.x(i), lattice.y(j), z), _stride, material);
+            slab.set(i, j, value, material);
+        };
+
+        for (int f = 0; f < 6; f++) {
+            if (!_faces[f].stride) {
+                continue;
+            }
+            if (f / 2 == 2) {
+                if (static_cast<float>(z) == _faces[f].coordinate) {
+                    for (int j = 0; j <= cells.y; j++) {
+                        for (int i = 0; i <= cells.x; i++) {
+                            projectPoint(i, j);
+                        }
+                    }
+                }
+            } else if (f / 2 == 0) {
+                const int i = f % 2 ? cells.x : 0;
+                for (int j = 0; j <= cells.y; j++) {
+                    projectPoint(i, j);
+                }
+            } else {
+                const int j = f % 2 ? cells.y : 0;
+                for (int i = 0; i <= cells.x; i++) {
+                    projectPoint(i, j);
+                }
+            }
+        }
+
+        for (int e = 0; e < 12; e++) {
+            const auto& edge = _edges[e];
+            if (!edge.stride) {
+                continue;
+            }
+            const int axis = e / 4;
+            if (axis == 2) {
+                // runs through every slab, at a single point
+                projectPoint(e & 2 ? cells.x : 0, e & 1 ? cells.y : 0);
+            } else if (static_cast<float>(z) == edge.coordinates.y) {
+                if (axis == 0) {
+                    const int j = e & 2 ? cells.y : 0;
+                    for (int i = 0; i <= cells.x; i++) {
+                        projectPoint(i, j);
+                    }
+                } else {
+                    const int i = e & 2 ? cells.x : 0;
+                    for (int j = 0; j <= cells.y; j++) {
+                        projectPoint(i, j);
+                    }
+                }
+            }
+        }
+    }
+
+    /*
+    If v lies on a transition face, move it onto the coarse neighbor's contour.
+    Vertices on transition edges already agree with the neighbor, via project().
+    Returns true if v was moved.
+    */
+    bool snap(Vertex& v) const
+    {
+        bool snapped = false;
+        for (int f = 0; f < 6; f++) {
+            const auto& face = _faces[f];
+            if (face.stride > 0 && std::abs(v.pos[f / 2] - face.coordinate) < kOnFaceEpsilon) {
+                snapped = snapToFace(f, v) || snapped;
+            }
+        }
+        return snapped;
+    }
+
+    /*
+    Snap each vertex of triangle; without smooth normals, recompute its
+    normal if any moved
+    */
+    void snap(Triangle<Vertex>& triangle) const
+    {
+        const bool a = snap(triangle.a);
+        const bool b = snap(triangle.b);
+        const bool c = snap(triangle.c);
+        if ((a || b || c) && !_smoothNormals) {
+            const glm::vec3 n = glm::cross(triangle.b.pos - triangle.a.pos, triangle.c.pos - triangle.a.pos);
+            if (glm::length2(n) > 0) {
+                triangle.a.triangleNormal = triangle.b.triangleNormal = triangle.c.triangleNormal = glm::normalize(n);
+            }
+        }
+    }
+
+private:
+    static constexpr float kOnFaceEpsilon = 1e-4F;
+
+    struct Face {
+        float coordinate = 0;
+        int stride = 0;
+    };
+
+    struct Edge {
+        // coordinates on the two axes perpendicular to the edge, see tangentAxes
+        glm::vec2 coordinates { 0 };
+        int stride = 0;
+    };
+
+    // the two axes perpendicular to axis, in ascending order
+    static glm::ivec2 tangentAxes(int axis)
+    {
+        return axis == 0 ? glm::ivec2(1, 2) : axis == 1 ? glm::ivec2(0, 2) : glm::ivec2(0, 1);
+    }
+
+    float sample(const glm::vec3& p, MaterialState& material) const
+    {
+        return _valueSampler(p, material);
+    }
+
+    /*
+    The field at p as seen by the coarsest neighbor coarser than stride whose
+    face or edge p lies on: the (bi)linear interpolation of that neighbor's
+    lattice, whose corners may in turn lie on an even coarser neighbor. Where
+    no such neighbor touches p, the field itself.
+    */
+    float valueAt(const glm::vec3& p, int stride, MaterialState& material) const
+    {
+        int coarsest = stride;
+        glm::ivec2 axes(0);
+        int numAxes = 0;
+        for (int f = 0; f < 6; f++) {
+            const auto& face = _faces[f];
+            if (face.stride > coarsest && std::abs(p[f / 2] - face.coordinate) < kOnFaceEpsilon) {
+                coarsest = face.stride;
+                axes = tangentAxes(f / 2);
+                numAxes = 2;
+            }
+        }
+        for (int e = 0; e < 12; e++) {
+            const auto& edge = _edges[e];
+            const auto t = tangentAxes(e / 4);
+            if (edge.stride > coarsest
+                && std::abs(p[t.x] - edge.coordinates.x) < kOnFaceEpsilon
+                && std::abs(p[t.y] - edge.coordinates.y) < kOnFaceEpsilon) {
+                coarsest = edge.stride;
+                axes = glm::ivec2(e / 4);
+                numAxes = 1;
+            }
+        }
+
+        if (numAxes == 0) {
+            return sample(p, material);
+        }
+
+        const float s = static_cast<float>(coarsest);
+        glm::vec3 origin = p;
+        float fractions[2] = { 0, 0 };
+        for (int a = 0; a < numAxes; a++) {
+            origin[axes[a]] = std::floor(p[axes[a]] / s) * s;
+            fractions[a] = (p[axes[a]] - origin[axes[a]]) / s;
+        }
+
+        // evaluate the 1, 2 or 4 corners of the surrounding lattice edge or face which contribute
+        float values[2][2];
+        MaterialState materials[2][2];
+        for (int w = 0; w < 2; w++) {
+            for (int u = 0; u < 2; u++) {
+                const int su = fractions[0] > 0 ? u : 0;
+                const int sw = fractions[1] > 0 ? w : 0;
+                if (su != u || sw != w) {
+                    values[w][u] = values[sw][su];
+                    materials[w][u] = materials[sw][su];
+                    continue;
+                }
+
+                glm::vec3 corner = origin;
+                corner[axes[0]] += u * s;
+                if (numAxes > 1) {
+                    corner[axes[1]] += w * s;
+                }
+                values[w][u] = valueAt(corner, coarsest, materials[w][u]);
+            }
+        }
+
+        material = mix(
+            mix(materials[0][0], materials[0][1], fractions[0]),
+            mix(materials[1][0], materials[1][1], fractions[0]),
+            fractions[1]);
+        return glm::mix(
+            glm::mix(values[0][0], values[0][1], fractions[0]),
+            glm::mix(values[1][0], values[1][1], fractions[0]),
+            fractions[1]);
+    }
+
+    bool snapToFace(int f, Vertex& v) const
+    {
+        const auto& face = _faces[f];
+        const auto t = tangentAxes(f / 2);
+        const float s = static_cast<float>(face.stride);
+        const glm::vec2 p(v.pos[t.x], v.pos[t.y]);
+        const glm::vec2 p0 = glm::floor(p / s) * s;
+        const glm::vec2 rel = p - p0;
+        if (rel.x < kOnFaceEpsilon || rel.y < kOnFaceEpsilon || s - rel.x < kOnFaceEpsilon || s - rel.y < kOnFaceEpsilon) {
+            // on a coarse lattice edge, where project() already made us agree
+            return false;
+        }
+
+        // the coarse face cell's corners, counterclockwise
+        const glm::vec2 corners[4] = { p0, p0 + glm::vec2(s, 0), p0 + glm::vec2(s, s), p0 + glm::vec2(0, s) };
+        float values[4];
+        for (int i = 0; i < 4; i++) {
+            glm::vec3 c = v.pos;
+            c[t.x] = corners[i].x;
+            c[t.y] = corners[i].y;
+            MaterialState _;
+            values[i] = valueAt(c, face.stride, _);
+        }
+
+        // where the contour crosses the cell's edges, as Lerp() would place it
+        glm::vec2 crossings[4];
+        int numCrossings = 0;
+        for (int i = 0; i < 4; i++) {
+            const int a = i, b = (i + 1) % 4;
+            if ((values[a] < _isolevel) != (values[b] < _isolevel)) {
+                const float mu = (_isolevel - values[a]) / (values[b] - values[a]);
+                crossings[numCrossings++] = glm::mix(corners[a], corners[b], mu);
+            }
+        }
+
+        if (numCrossings < 2) {
+            return false;
+        }
+
+        // with 4 crossings the face is ambiguous; use whichever candidate segment is nearest
+        glm::vec2 best = p;
+        float bestDist2 = std::numeric_limits<float>::max();
+        const int segments[4][2] = { { 0, 1 }, { 2, 3 }, { 1, 2 }, { 3, 0 } };
+        for (int i = 0, N = numCrossings == 2 ? 1 : 4; i < N; i++) {
+            const auto a = crossings[segments[i][0]];
+            const auto ab = crossings[segments[i][1]] - a;
+            const float len2 = glm::dot(ab, ab);
+            const float mu = len2 > 0 ? glm::clamp(glm::dot(p - a, ab) / len2, 0.0F, 1.0F) : 0.0F;
+            const auto q = a + ab * mu;
+            const float d2 = glm::dot(q - p, q - p);
+            if (d2 < bestDist2) {
+                bestDist2 = d2;
+                best = q;
+            }
+        }
+
+        v.pos[t.x] = best.x;
+        v.pos[t.y] = best.y;
+        return true;
+    }
+
+    const ValueSampler& _valueSampler;
+    float _isolevel;
+    int _stride;
+    bool _smoothNormals;
+    bool _active = false;
+    Face _faces[6];
+    Edge _edges[12];
+};
+
+//
+// Indexed Marching
+//
+
+inline constexpr uint32_t kNoVertex = std::numeric_limits<uint32_t>::max();
+
+/*
+Describes one of the 12 cube edges in terms of the lattice: the corner at
+the edge's minimal end (a), the corner at its far end (b), the lattice offset
+of corner a from the cell origin, the axis the edge runs along (0:x, 1:y, 2:z)
+and for x & y edges, whether it lies in the front (0) or back (1) z-plane.
+Edges 2, 3, 6 & 7 run "backwards" in Bourke's ordering, so a & b are swapped
+here; an edge shared by several cells always interpolates in the same direction.
+*/
+struct EdgeInfo {
+    int a, b;
+    int dx, dy;
+    int axis;
+    int plane;
+};
+
+inline constexpr EdgeInfo kEdges[12] = {
+    { 0, 1, 0, 0, 0, 0 },
+    { 1, 2, 1, 0, 1, 0 },
+    { 3, 2, 0, 1, 0, 0 },
+    { 0, 3, 0, 0, 1, 0 },
+    { 4, 5, 0, 0, 0, 1 },
+    { 5, 6, 1, 0, 1, 1 },
+    { 7, 6, 0, 1, 0, 1 },
+    { 4, 7, 0, 0, 1, 1 },
+    { 0, 4, 0, 0, 2, 0 },
+    { 1, 5, 1, 0, 2, 0 },
+    { 2, 6, 1, 1, 2, 0 },
+    { 3, 7, 0, 1, 2, 0 }
+};
+
+/*
+Copy the materials of the corners of cell (i,j) at either end of the edges
+in the kEdgeTable mask edges, the only ones Lerp() reads, from front & back
+as for GetGridCell
+*/
+inline void GetGridCellMaterials(int i, int j, int edges, const Slab& front, const Slab& back, GridCell& cell)
+{
+    int corners = 0;
+    for (int e = 0; e < 12; e++) {
+        if (edges & (1 << e)) {
+            corners |= (1 << kEdges[e].a) | (1 << kEdges[e].b);
+        }
+    }
+
+    const glm::ivec2 offsets[4] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+    for (int n = 0; n < 4; n++) {
+        const auto c = glm::ivec2(i, j) + offsets[n];
+        if (corners & (1 << n)) {
+            cell.material[n] = front.material(c.x, c.y);
+        }
+        if (corners & (1 << (n + 4))) {
+            cell.material[n + 4] = back.material(c.x, c.y);
+        }
+    }
+}
+
+/*
+Caches the index of the vertex generated on each lattice edge for the
+front & back z-planes of the current slab pair, and for the z-edges
+connecting them. Cells sharing an edge share its vertex.
+*/
+class EdgeCache {
+public:
+    EdgeCache() = default;
+    EdgeCache(const EdgeCache&) = delete;
+    EdgeCache& operator=(const EdgeCache&) = delete;
+
+    void reset(const Lattice& lattice)
+    {
+        _width = lattice.cells().x + 1;
+        const std::size_t count = _width * (lattice.cells().y + 1);
+        for (auto& plane : _planes) {
+            plane.xEdges.assign(count, kNoVertex);
+            plane.yEdges.assign(count, kNoVertex);
+        }
+        _zEdges.assign(count, kNoVertex);
+        _front = 0;
+    }
+
+    /*
+    Step from slab pair (z, z+1) to (z+1, z+2); the back plane's
+    edges become the front plane's, everything else is cleared
+    */
+    void advance()
+    {
+        auto& plane = _planes[_front];
+        std::fill(plane.xEdges.begin(), plane.xEdges.end(), kNoVertex);
+        std::fill(plane.yEdges.begin(), plane.yEdges.end(), kNoVertex);
+        std::fill(_zEdges.begin(), _zEdges.end(), kNoVertex);
+        _front = 1 - _front;
+    }
+
+    /*
+    Get the vertex index slot for edge of the cell at lattice index (i,j)
+    */
+    uint32_t& at(const EdgeInfo& edge, int i, int j)
+    {
+        const std::size_t n = (j + edge.dy) * _width + (i + edge.dx);
+        switch (edge.axis) {
+        case 0:
+            return _planes[(_front + edge.plane) % 2].xEdges[n];
+        case 1:
+            return _planes[(_front + edge.plane) % 2].yEdges[n];
+        default:
+            return _zEdges[n];
+        }
+    }
+
+private:
+    struct Plane {
+        std::vector<uint32_t> xEdges, yEdges;
+    };
+
+    int _width = 0;
+    int _front = 0;
+    Plane _planes[2];
+    std::vector<uint32_t> _zEdges;
+};
+
+/*
+Indexed variant of Polygonise. The vertex on each of the cell's edges the
+surface crosses is looked up in (or added to) the slot edgeSlot(EdgeInfo)
+returns, e.g. an EdgeCache entry. Unless the cell has gradients, which
+give each vertex its normal, each triangle's face normal is accumulated
+onto its vertices; the caller normalizes them once the march is complete.
+*/
+template <class EdgeSlot>
+void PolygoniseIndexed(const GridCell& cell, float isolevel, EdgeSlot&& edgeSlot,
+    IndexedTriangleConsumer<Vertex>& tc)
+{
+    const int cubeIndex = CubeIndex(cell, isolevel);
+    const int edges = kEdgeTable[cubeIndex];
+    if (edges == 0)
+        return;
+
+    uint32_t indices[12];
+    for (int i = 0; i < 12; i++) {
+        if (edges & (1 << i)) {
+            const auto& edge = kEdges[i];
+            uint32_t& slot = edgeSlot(edge);
+            if (slot == kNoVertex) {
+                Vertex v = Lerp(isolevel, cell, edge.a, edge.b);
+                if (!cell.hasGradients) {
+                    v.triangleNormal = glm::vec3(0);
+                }
+                slot = tc.addVertex(v);
+            }
+            indices[i] = slot;
+        }
+    }
+
+    for (int i = 0; kTriTable[cubeIndex][i] != -1; i += 3) {
+        const uint32_t a = indices[kTriTable[cubeIndex][i]];
+        const uint32_t b = indices[kTriTable[cubeIndex][i + 1]];
+        const uint32_t c = indices[kTriTable[cubeIndex][i + 2]];
+
+        if (!cell.hasGradients) {
+            // area weighted face normal
+            auto& va = tc.getVertex(a);
+            auto& vb = tc.getVertex(b);
+            auto& vc = tc.getVertex(c);
+            const glm::vec3 n = glm::cross(vb.pos - va.pos, vc.pos - va.pos);
+            va.triangleNormal += n;
+            vb.triangleNormal += n;
+            vc.triangleNormal += n;
+        }
+
+        tc.addTriangle(a, b, c);
+    }
+}
+
+//
+// Surface Tracking
+//
+
+/*
+True when march() should track the surface of lattice rather than visit every
+cell (see MarchOptions::seedSpacing). Probing a region's faces costs about as
+much as marching a region only a few probe intervals across, so those are
+marched cell by cell.
+*/
+inline bool TracksSurface(const Lattice& lattice, int seedSpacing)
+{
+    const auto cells = lattice.cells();
+    return seedSpacing > 0 && std::min(cells.x, std::min(cells.y, cells.z)) > 2 * seedSpacing;
+}
+
+/*
+Visits only the cells of a march region which the surface crosses. Seed cells
+are found by probing every lattice edge on the region's faces, so a surface
+reaching in from a neighboring region is always found, and the edges of a
+coarse lattice through its interior; from these the surface is followed across
+the cell faces it crosses. Lattice points are sampled on demand and cached.
+Surface components which don't reach the region's faces and which fit between
+the coarse lattice's points are missed.
+*/
+template <class ValueSampler>
+class SurfaceTracker {
+public:
+    SurfaceTracker(const Lattice& lattice, const ValueSampler& valueSampler,
+        const TransitionFaces<ValueSampler>& transitions, float isolevel, bool gradients)
+        : _lattice(lattice)
+        , _cells(lattice.cells())
+        , _valueSampler(valueSampler)
+        , _transitions(transitions)
+        , _isolevel(isolevel)
+        , _gradients(gradients)
+        , _bricks((_cells + kBrickSize) / kBrickSize)
+        , _brickSlots(static_cast<std::size_t>(_bricks.x) * _bricks.y * _bricks.z, -1)
+        , _visited(static_cast<std::size_t>(_cells.x) * _cells.y * _cells.z, 0)
+    {
+    }
+
+    SurfaceTracker(const SurfaceTracker&) = delete;
+    SurfaceTracker& operator=(const SurfaceTracker&) = delete;
+
+    /*
+    Call visit(cell, i, j, k) for each cell the surface crosses reachable
+    from the seeds found probing the region's faces and a coarse lattice
+    spaced seedSpacing cells apart. When tracking with gradients, the cells
+    receive their corners' gradients, as LatticeGradient computes them.
+    */
+    template <class Visit>
+    void track(int seedSpacing, Visit&& visit)
+    {
+        seedFaces();
+        seedInterior(std::max(seedSpacing, 1));
+
+        GridCell cell;
+        while (!_pending.empty()) {
+            const auto c = _pending.back();
+            _pending.pop_back();
+
+            getCell(c, cell);
+            if (kEdgeTable[CubeIndex(cell, _isolevel)] == 0) {
+                continue;
+            }
+            if (_gradients) {
+                for (int n = 0; n < 8; n++) {
+                    cell.gradient[n] = gradientAt(c + cornerOffset(n));
+                }
+                cell.hasGradients = true;
+            }
+            visit(cell, c.x, c.y, c.z);
+
+            // the surface only continues into neighbors across faces it crosses
+            for (int f = 0; f < 6; f++) {
+                const auto& corners = kFaceCorners[f];
+                const bool inside = cell.val[corners[0]] < _isolevel;
+                for (int n = 1; n < 4; n++) {
+                    if ((cell.val[corners[n]] < _isolevel) != inside) {
+                        glm::ivec3 neighbor = c;
+                        neighbor[f / 2] += f % 2 ? 1 : -1;
+                        push(neighbor);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    struct Sample {
+        float value = 0;
+        MaterialState material;
+    };
+
+    /*
+    Lattice points are cached in bricks of kBrickSize^3, allocated when first
+    touched, so memory follows the surface rather than the region's volume
+    */
+    static constexpr int kBrickSize = 4;
+    using Brick = std::array<Sample, kBrickSize * kBrickSize * kBrickSize>;
+
+    // GridCell corners on each face, indexed -x, +x, -y, +y, -z, +z
+    static constexpr int kFaceCorners[6][4] = {
+        { 0, 3, 7, 4 },
+        { 1, 2, 6, 5 },
+        { 0, 1, 5, 4 },
+        { 3, 2, 6, 7 },
+        { 0, 1, 2, 3 },
+        { 4, 5, 6, 7 }
+    };
+
+    // the two axes perpendicular to axis, in ascending order
+    static glm::ivec2 tangentAxes(int axis)
+    {
+        return axis == 0 ? glm::ivec2(1, 2) : axis == 1 ? glm::ivec2(0, 2) : glm::ivec2(0, 1);
+    }
+
+    const Sample& sampleAt(const glm::ivec3& p)
+    {
+        const glm::ivec3 b = p / kBrickSize;
+        auto& slot = _brickSlots[(static_cast<std::size_t>(b.z) * _bricks.y + b.y) * _bricks.x + b.x];
+        if (slot < 0) {
+            slot = static_cast<int>(_brickStore.size());
+            _brickStore.emplace_back();
+            for (auto& sample : _brickStore.back()) {
+                sample.value = std::numeric_limits<float>::quiet_NaN();
+            }
+        }
+
+        const glm::ivec3 o = p - b * kBrickSize;
+        auto& sample = _brickStore[slot][(o.z * kBrickSize + o.y) * kBrickSize + o.x];
+        if (std::isnan(sample.value)) {
+            // as the slabs march() samples would hold, after TransitionFaces::project()
+            const glm::vec3 position(_lattice.x(p.x), _lattice.y(p.y), _lattice.z(p.z));
+            sample.value = _transitions.active()
+                ? _transitions.projectedValueAt(position, sample.material)
+                : _valueSampler(position, sample.material);
+        }
+        return sample;
+    }
+
+    bool crosses(const glm::ivec3& a, const glm::ivec3& b)
+    {
+        return (sampleAt(a).value < _isolevel) != (sampleAt(b).value < _isolevel);
+    }
+
+    void push(const glm::ivec3& c)
+    {
+        if (c.x < 0 || c.y < 0 || c.z < 0 || c.x >= _cells.x || c.y >= _cells.y || c.z >= _cells.z) {
+            return;
+        }
+        const std::size_t i = (static_cast<std::size_t>(c.z) * _cells.y + c.y) * _cells.x + c.x;
+        if (!_visited[i]) {
+            _visited[i] = 1;
+            _pending.push_back(c);
+        }
+    }
+
+    // seed the cells sharing the lattice edge from p along axis
+    void seedEdge(glm::ivec3 p, int axis)
+    {
+        const auto t = tangentAxes(axis);
+        for (int v = -1; v <= 0; v++) {
+            for (int u = -1; u <= 0; u++) {
+                glm::ivec3 c = p;
+                c[t.x] += u;
+                c[t.y] += v;
+                push(c);
+            }
+        }
+    }
+
+    void seedFaces()
+    {
+        for (int axis = 0; axis < 3; axis++) {
+            const auto t = tangentAxes(axis);
+            for (int side = 0; side < 2; side++) {
+                glm::ivec3 p(0);
+                p[axis] = side ? _cells[axis] : 0;
+                for (p[t.y] = 0; p[t.y] <= _cells[t.y]; p[t.y]++) {
+                    for (p[t.x] = 0; p[t.x] <= _cells[t.x]; p[t.x]++) {
+                        for (int a = 0; a < 2; a++) {
+                            glm::ivec3 q = p;
+                            q[t[a]]++;
+                            if (q[t[a]] <= _cells[t[a]] && crosses(p, q)) {
+                                seedEdge(p, t[a]);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void seedInterior(int spacing)
+    {
+        // coarse lattice coordinates along an axis, including the region's max face
+        const auto coarse = [spacing](int cells) {
+            std::vector<int> coordinates;
+            for (int i = 0; i < cells; i += spacing) {
+                coordinates.push_back(i);
+            }
+            coordinates.push_back(cells);
+            return coordinates;
+        };
+
+        const std::vector<int> coordinates[3] = { coarse(_cells.x), coarse(_cells.y), coarse(_cells.z) };
+        glm::ivec3 index;
+        for (index.z = 0; index.z < static_cast<int>(coordinates[2].size()); index.z++) {
+            for (index.y = 0; index.y < static_cast<int>(coordinates[1].size()); index.y++) {
+                for (index.x = 0; index.x < static_cast<int>(coordinates[0].size()); index.x++) {
+                    const glm::ivec3 p(coordinates[0][index.x], coordinates[1][index.y], coordinates[2][index.z]);
+                    for (int axis = 0; axis < 3; axis++) {
+                        if (index[axis] + 1 >= static_cast<int>(coordinates[axis].size())) {
+                            continue;
+                        }
+
+                        glm::ivec3 q = p;
+                        q[axis] = coordinates[axis][index[axis] + 1];
+                        if (!crosses(p, q)) {
+                            continue;
+                        }
+
+                        // find the lattice edge between them where the surface crosses
+                        for (glm::ivec3 a = p; a[axis] < q[axis]; a[axis]++) {
+                            glm::ivec3 b = a;
+                            b[axis]++;
+                            if (crosses(a, b)) {
+                                seedEdge(a, axis);
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // offset of a cell's corner n from its min corner, in GridCell corner order; see GetGridCell
+    static glm::ivec3 cornerOffset(int n)
+    {
+        return glm::ivec3((n & 1) ^ ((n >> 1) & 1), (n >> 1) & 1, n >> 2);
+    }
+
+    int coordinate(const glm::ivec3& p, int axis) const
+    {
+        return _lattice.coordinate(axis, p[axis]);
+    }
+
+    // as LatticeGradient computes it
+    glm::vec3 gradientAt(const glm::ivec3& p)
+    {
+        const int stride = _lattice.stride();
+        const auto valueAt = [&](int axis, int direction) -> float {
+            glm::ivec3 q = p;
+            q[axis] += direction;
+            if (q[axis] >= 0 && q[axis] <= _cells[axis] && coordinate(q, axis) == coordinate(p, axis) + direction * stride) {
+                return sampleAt(q).value;
+            }
+
+            glm::vec3 position(_lattice.x(p.x), _lattice.y(p.y), _lattice.z(p.z));
+            position[axis] += static_cast<float>(direction * stride);
+            MaterialState _;
+            return _valueSampler(position, _);
+        };
+
+        glm::vec3 gradient;
+        for (int axis = 0; axis < 3; axis++) {
+            gradient[axis] = (valueAt(axis, 1) - valueAt(axis, -1)) / static_cast<float>(2 * stride);
+        }
+        return gradient;
+    }
+
+    void getCell(const glm::ivec3& c, GridCell& cell)
+    {
+        for (int n = 0; n < 8; n++) {
+            const glm::ivec3 p = c + cornerOffset(n);
+            const auto& sample = sampleAt(p);
+            cell.pos[n] = glm::vec3(_lattice.x(p.x), _lattice.y(p.y), _lattice.z(p.z));
+            cell.val[n] = sample.value;
+            cell.material[n] = sample.material;
+        }
+        cell.occupied = true;
+    }
+
+    const Lattice& _lattice;
+    glm::ivec3 _cells;
+    const ValueSampler& _valueSampler;
+    const TransitionFaces<ValueSampler>& _transitions;
+    float _isolevel;
+    bool _gradients;
+    glm::ivec3 _bricks;
+    std::vector<int> _brickSlots;
+    std::deque<Brick> _brickStore;
+    std::vector<uint8_t> _visited;
+    std::vector<glm::ivec3> _pending;
+};
+
+/*
+Visit the cells of lattice the isosurface crosses plane by plane, calling
+visit(cell, x, y, z) for each, and endPlane(z) once each plane of cells
+[z,z+1) is done. Each z-plane
+of lattice points is sampled once, and held in a slab while the cells reading it
+are visited. When gradients is true, cells the isosurface crosses also receive
+their corners' gradients, which read the planes either side of a cell's, so
+sampling runs a plane ahead.
+*/
+template <class ValueSampler, class Visit, class EndPlane>
+void MarchLattice(const Lattice& lattice, const ValueSampler& valueSampler,
+    const TransitionFaces<ValueSampler>& transitions, bool gradients, float isolevel,
+    Visit&& visit, EndPlane&& endPlane)
+{
+    const auto cells = lattice.cells();
+    const int numSlabs = gradients ? 4 : 2;
+    Slab slabs[4];
+    const auto slab = [&](int k) -> Slab& { return slabs[k % numSlabs]; };
+    const auto sample = [&](int k) {
+        slab(k).sample(lattice, lattice.z(k), valueSampler);
+        transitions.project(lattice, lattice.z(k), slab(k));
+        slab(k).classify(isolevel);
+    };
+
+    GridCell cell;
+    std::vector<int> active;
+    active.reserve(cells.x);
+    sample(0);
+    sample(1);
+    for (int z = 0; z < cells.z; z++) {
+        // plane z + 1 replaces z - 1 on a 2 slab ring; on a 4 slab
+        // ring, it was sampled ahead in the previous pass
+        const bool ahead = gradients && z + 2 <= cells.z;
+        if (ahead) {
+            sample(z + 2);
+        } else if (!gradients && z > 0) {
+            sample(z + 1);
+        }
+
+        Slab& front = slab(z);
+        Slab& back = slab(z + 1);
+        const Slab* below = gradients && z > 0 ? &slab(z - 1) : nullptr;
+        const Slab* above = ahead ? &slab(z + 2) : nullptr;
+
+        for (int y = 0; y < cells.y; y++) {
+            ActiveCells(lattice, y, front, back, active);
+            for (const int x : active) {
+                GetGridCell(x, y, z, lattice, front, back, cell);
+                GetGridCellMaterials(x, y, kEdgeTable[CubeIndex(cell, isolevel)], front, back, cell);
+                if (gradients) {
+                    GetGridCellGradients(x, y, z, lattice, valueSampler, below, front, back, above, cell);
+                }
+                visit(cell, x, y, z);
+            }
+        }
+
+        endPlane(z);
+    }
+}
+
+/*
+Non-indexed marching cubes kernel behind march(); see it for ValueSampler's
+requirements. Calls emit(const Triangle<Vertex>&) for each generated triangle.
+*/
+template <class ValueSampler, class Emit>
+void March(util::iAABB region, const ValueSampler& valueSampler, const MarchOptions& options, Emit&& emit)
+{
+    if (region.max.x <= region.min.x || region.max.y <= region.min.y || region.max.z <= region.min.z) {
+        return;
+    }
+
+    Triangle<Vertex> triangles[5];
+    constexpr float IsoLevel = 0.5F;
+
+    const Lattice lattice(region, options.stride);
+    const TransitionFaces<ValueSampler> transitions(region, options, valueSampler, IsoLevel);
+    const auto polygonise = [&](const GridCell& cell) {
+        for (int t = 0, nTriangles = Polygonise(cell, IsoLevel, triangles); t < nTriangles; t++) {
+            if (transitions.active()) {
+                transitions.snap(triangles[t]);
+            }
+            emit(triangles[t]);
+        }
+    };
+
+    if (TracksSurface(lattice, options.seedSpacing)) {
+        SurfaceTracker<ValueSampler> tracker(lattice, valueSampler, transitions, IsoLevel, options.smoothNormals);
+        tracker.track(options.seedSpacing, [&](const GridCell& cell, int, int, int) {
+            polygonise(cell);
+        });
+        return;
+    }
+
+    MarchLattice(
+        lattice, valueSampler, transitions, options.smoothNormals, IsoLevel,
+        [&](const GridCell& cell, int, int, int) { polygonise(cell); },
+        [](int) {});
+}
+
+//
+// Surface Nets
+//
+
+/*
+Naive Surface Nets places one vertex in each cell the isosurface passes through,
+at the mean of the points where it crosses the cell's edges, and joins the
+vertices of the 4 cells around each lattice edge the surface crosses with a
+quad. Vertices are shared by construction, and the mesh has about as many
+triangles as marching cubes produces, but none of its slivers.
+*/
+
+/*
+Compute the surface nets vertex of cell; returns false if the
+isosurface doesn't pass through it
+*/
+inline bool SurfaceNetsVertex(const GridCell& cell, float isolevel, Vertex& vertex)
+{
+    const int edges = kEdgeTable[CubeIndex(cell, isolevel)];
+    if (edges == 0)
+        return false;
+
+    Vertex sum;
+    sum.pos = glm::vec3(0);
+    sum.color = glm::vec4(0);
+    int count = 0;
+    for (int i = 0; i < 12; i++) {
+        if (edges & (1 << i)) {
+            const Vertex v = Lerp(isolevel, cell, kEdges[i].a, kEdges[i].b);
+            sum.pos += v.pos;
+            sum.color += v.color;
+            sum.shininess += v.shininess;
+            sum.texture0 += v.texture0;
+            sum.texture1 += v.texture1;
+            count++;
+        }
+    }
+
+    const float scale = 1.0F / static_cast<float>(count);
+    vertex.pos = sum.pos * scale;
+    vertex.color = sum.color * scale;
+    vertex.shininess = sum.shininess * scale;
+    vertex.texture0 = sum.texture0 * scale;
+    vertex.texture1 = sum.texture1 * scale;
+    vertex.triangleNormal = glm::vec3(0);
+    return true;
+}
+
+/*
+The surface nets vertices of a single z-layer of cells; index is the vertex's
+index in an IndexedTriangleConsumer, assigned when a quad first references it.
+*/
+class SurfaceNetsLayer {
+public:
+    struct Cell {
+        Vertex vertex;
+        uint32_t index = kNoVertex;
+        bool occupied = false;
+    };
+
+    SurfaceNetsLayer() = default;
+    SurfaceNetsLayer(const SurfaceNetsLayer&) = delete;
+    SurfaceNetsLayer& operator=(const SurfaceNetsLayer&) = delete;
+
+    void reset(const Lattice& lattice)
+    {
+        _width = lattice.cells().x;
+        _cells.resize(static_cast<std::size_t>(lattice.cells().x * lattice.cells().y));
+        clear();
+    }
+
+    void clear()
+    {
+        for (auto& cell : _cells) {
+            cell.index = kNoVertex;
+            cell.occupied = false;
+        }
+    }
+
+    Cell& at(int i, int j) { return _cells[j * _width + i]; }
+
+private:
+    int _width = 0;
+    std::vector<Cell> _cells;
+};
+
+/*
+Run Naive Surface Nets over region, calling emitQuad(Cell* corners[4]) for
+each quad, wound counterclockwise seen from outside the surface.
+A region owns the lattice edges which start inside it, short of its max faces;
+the quads around those on its min faces need the cells just outside it, so the
+lattice is extended one stride past each min face. Neighboring regions thereby
+compute identical vertices for the cells they share, and meet without cracks.
+*/
+template <class ValueSampler, class EmitQuad>
+void SurfaceNets(const util::iAABB& region, const ValueSampler& valueSampler, int stride, float isolevel, EmitQuad&& emitQuad)
+{
+    stride = std::max(stride, 1);
+    const Lattice lattice(util::iAABB(region.min - glm::ivec3(stride), region.max), stride);
+    const auto cells = lattice.cells();
+
+    GridCell cell;
+    Slab slabs[2];
+    Slab* front = &slabs[0];
+    Slab* back = &slabs[1];
+    SurfaceNetsLayer layers[2];
+    SurfaceNetsLayer* previous = &layers[0];
+    SurfaceNetsLayer* current = &layers[1];
+    previous->reset(lattice);
+    current->reset(lattice);
+
+    // emits the quad around the lattice edge whose start point has value a; corners
+    // run counterclockwise about the edge's axis, which faces out when a is inside
+    const auto quad = [&emitQuad, isolevel](float a, SurfaceNetsLayer::Cell* c0, SurfaceNetsLayer::Cell* c1,
+                          SurfaceNetsLayer::Cell* c2, SurfaceNetsLayer::Cell* c3) {
+        SurfaceNetsLayer::Cell* corners[4] = { c0, c1, c2, c3 };
+        if (a < isolevel) {
+            std::swap(corners[1], corners[3]);
+        }
+        emitQuad(corners);
+    };
+
+    std::vector<int> active;
+    active.reserve(cells.x);
+    front->sample(lattice, lattice.z(0), valueSampler);
+    front->classify(isolevel);
+    for (int k = 0; k < cells.z; k++) {
+        back->sample(lattice, lattice.z(k + 1), valueSampler);
+        back->classify(isolevel);
+
+        current->clear();
+        for (int j = 0; j < cells.y; j++) {
+            ActiveCells(lattice, j, *front, *back, active);
+            for (const int i : active) {
+                GetGridCell(i, j, k, lattice, *front, *back, cell);
+                GetGridCellMaterials(i, j, kEdgeTable[CubeIndex(cell, isolevel)], *front, *back, cell);
+                auto& c = current->at(i, j);
+                c.occupied = SurfaceNetsVertex(cell, isolevel, c.vertex);
+            }
+        }
+
+        // layer 0 lies outside the region, so only the layers after it emit quads
+        if (k > 0) {
+            for (int j = 1; j < cells.y; j++) {
+                for (int i = 1; i < cells.x; i++) {
+                    // the z-edge from plane k to k+1, between the 4 cells of this layer around it
+                    const float a = front->value(i, j);
+                    if ((a < isolevel) != (back->value(i, j) < isolevel)) {
+                        quad(a, &current->at(i - 1, j - 1), &current->at(i, j - 1), &current->at(i, j), &current->at(i - 1, j));
+                    }
+
+                    // the x & y edges in plane k, between the previous layer and this one
+                    if ((a < isolevel) != (front->value(i + 1, j) < isolevel)) {
+                        quad(a, &previous->at(i, j - 1), &previous->at(i, j), &current->at(i, j), &current->at(i, j - 1));
+                    }
+                    if ((a < isolevel) != (front->value(i, j + 1) < isolevel)) {
+                        quad(a, &previous->at(i - 1, j), &current->at(i - 1, j), &current->at(i, j), &previous->at(i, j));
+                    }
+                }
+            }
+        }
+
+        std::swap(front, back);
+        std::swap(previous, current);
+    }
+}
+
+/*
+Split a surface nets quad along its shorter diagonal; writes the corner
+indices of the two triangles into triangles
+*/
+inline void TriangulateQuad(const SurfaceNetsLayer::Cell* const corners[4], int triangles[2][3])
+{
+    const float d02 = glm::length2(corners[2]->vertex.pos - corners[0]->vertex.pos);
+    const float d13 = glm::length2(corners[3]->vertex.pos - corners[1]->vertex.pos);
+    const int first = d02 <= d13 ? 0 : 1;
+    for (int t = 0; t < 2; t++) {
+        triangles[t][0] = first;
+        triangles[t][1] = (first + 1 + t) % 4;
+        triangles[t][2] = (first + 2 + t) % 4;
+    }
+}
+
+/*
+Non-indexed surface nets behind surfaceNets(); calls emit(const Triangle<Vertex>&)
+for each generated triangle, whose vertices take its face normal
+*/
+template <class ValueSampler, class Emit>
+void SurfaceNetsTriangles(const util::iAABB& region, const ValueSampler& valueSampler, int stride, float isolevel, Emit&& emit)
+{
+    SurfaceNets(region, valueSampler, stride, isolevel, [&emit](SurfaceNetsLayer::Cell* corners[4]) {
+        int triangles[2][3];
+        TriangulateQuad(corners, triangles);
+        for (const auto& t : triangles) {
+            Triangle<Vertex> triangle(corners[t[0]]->vertex, corners[t[1]]->vertex, corners[t[2]]->vertex);
+            const glm::vec3 n = glm::cross(triangle.b.pos - triangle.a.pos, triangle.c.pos - triangle.a.pos);
+            const glm::vec3 normal = glm::length2(n) > 0 ? glm::normalize(n) : glm::vec3(0, 1, 0);
+            triangle.a.triangleNormal = triangle.b.triangleNormal = triangle.c.triangleNormal = normal;
+            emit(triangle);
+        }
+    });
+}
+
 } // namespace mc::detail
 
 #endif /* marching_cubes_detail_h */
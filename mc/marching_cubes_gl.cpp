@@ -0,0 +1,66 @@
+#include <cstddef>
+
+#include <epoxy/gl.h>
+
+#include "marching_cubes.hpp"
+
+namespace mc {
+
+void Vertex::bindVertexAttributes()
+{
+    glVertexAttribPointer(
+        static_cast<GLuint>(AttributeLayout::Pos),
+        3,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(Vertex),
+        (const GLvoid*)offsetof(Vertex, pos));
+    glEnableVertexAttribArray(static_cast<GLuint>(AttributeLayout::Pos));
+
+    glVertexAttribPointer(
+        static_cast<GLuint>(AttributeLayout::Color),
+        4,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(Vertex),
+        (const GLvoid*)offsetof(Vertex, color));
+    glEnableVertexAttribArray(static_cast<GLuint>(AttributeLayout::Color));
+
+    glVertexAttribPointer(
+        static_cast<GLuint>(Vertex::AttributeLayout::TriangleNormal),
+        3,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(Vertex),
+        (const GLvoid*)offsetof(Vertex, triangleNormal));
+    glEnableVertexAttribArray(static_cast<GLuint>(AttributeLayout::TriangleNormal));
+
+    glVertexAttribPointer(
+        static_cast<GLuint>(Vertex::AttributeLayout::Shininess),
+        1,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(Vertex),
+        (const GLvoid*)offsetof(Vertex, shininess));
+    glEnableVertexAttribArray(static_cast<GLuint>(AttributeLayout::Shininess));
+
+    glVertexAttribPointer(
+        static_cast<GLuint>(Vertex::AttributeLayout::Texture0),
+        1,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(Vertex),
+        (const GLvoid*)offsetof(Vertex, texture0));
+    glEnableVertexAttribArray(static_cast<GLuint>(AttributeLayout::Texture0));
+
+    glVertexAttribPointer(
+        static_cast<GLuint>(Vertex::AttributeLayout::Texture1),
+        1,
+        GL_FLOAT,
+        GL_FALSE,
+        sizeof(Vertex),
+        (const GLvoid*)offsetof(Vertex, texture1));
+    glEnableVertexAttribArray(static_cast<GLuint>(AttributeLayout::Texture1));
+}
+
+} // namespace mc
@@ -9,10 +9,20 @@
 #ifndef triangle_consumer_hpp
 #define triangle_consumer_hpp
 
-#include "util/util.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
 
 namespace mc {
 
+template <class VertexType>
+class SharedTriangleSink;
+
 template <class VertexType>
 struct Triangle {
     VertexType a, b, c;
@@ -45,21 +55,22 @@ struct Triangle {
 };
 
 /*
- Consumes triangles with non-indexed storage. Usage:
-    consumer.clear();
+ Consumes triangles with non-indexed storage. TriangleConsumer only owns
+ CPU-side buffers; see GpuTriangleConsumer (gpu_triangle_consumer.hpp) for
+ a variant which uploads to a VBO on finish() and can draw. Usage:
+    consumer.start();
     for (...) {
         auto tri = ...;
         consumer.addTriangle(t);
     }
     consumer.finish();
-
-    consumer.draw();
  */
 template <class VertexType>
 class TriangleConsumer {
-private:
+protected:
+    friend class SharedTriangleSink<VertexType>;
+
     std::vector<VertexType> _vertices;
-    util::VertexStorage<VertexType> _gpuStorage { GL_TRIANGLES };
     size_t _numTriangles = 0;
 
 public:
@@ -82,27 +93,290 @@ public:
         _numTriangles++;
     }
 
-    void finish()
+    // Append the triangles consumed so far by another TriangleConsumer
+    void addTriangles(const TriangleConsumer<VertexType>& other)
+    {
+        _vertices.insert(_vertices.end(), other._vertices.begin(), other._vertices.end());
+        _numTriangles += other._numTriangles;
+    }
+
+    // Called when a march pass completes; subclasses may publish the vertices
+    virtual void finish()
     {
-        _gpuStorage.update(_vertices);
     }
 
     size_t getNumTriangles() const { return _numTriangles; }
 
-    void draw() const
+    // Vertices of the triangles consumed so far, three per triangle
+    const std::vector<VertexType>& getVertices() const { return _vertices; }
+
+    virtual void clear()
+    {
+        _vertices.clear();
+        _numTriangles = 0;
+    }
+};
+
+/*
+ Lets the threads of a march share one TriangleConsumer, which receives a single
+ contiguous mesh. Each thread appends through a Writer of its own, which reserves
+ room for a block of triangles with one atomic increment, and writes triangles
+ straight into it; nothing is buffered or merged per thread. start() takes the
+ target's vertex storage, leaving the target empty until commit() hands the new mesh
+ back, and sizes it for the meshes of recent passes; the previous pass's vertices are
+ left in place, so only the headroom beyond them is initialized. Blocks reserved past
+ that size are written to storage set aside, which commit() puts in place. commit()
+ then fills the unused tail of each writer's last block with triangles from the end
+ of the mesh, leaving it contiguous; triangles are in no particular order. Usage:
+    sink.start(consumer, numWriters);
+    // on thread i, while marching
+    sink.writer(i).addTriangle(t);
+    // once every writer is done
+    sink.commit();
+    consumer.finish();
+ Triangles already consumed elsewhere, e.g., cached geometry, are appended with add().
+ A pass must be committed before the next start()s.
+ */
+template <class VertexType>
+class SharedTriangleSink {
+public:
+    // Triangles a Writer reserves at a time
+    static constexpr size_t kBlockTriangles = 1024;
+
+    class Writer {
+    public:
+        void addTriangle(const Triangle<VertexType>& t)
+        {
+            if (_next == _end) {
+                _sink->reserveBlock(*this);
+            }
+            _next[0] = t.a;
+            _next[1] = t.b;
+            _next[2] = t.c;
+            _next += 3;
+        }
+
+    private:
+        friend class SharedTriangleSink<VertexType>;
+
+        SharedTriangleSink* _sink = nullptr;
+        // the block being written, and its offset in the mesh
+        size_t _blockOffset = 0;
+        VertexType* _block = nullptr;
+        VertexType* _next = nullptr;
+        VertexType* _end = nullptr;
+    };
+
+    SharedTriangleSink() = default;
+    SharedTriangleSink(const SharedTriangleSink&) = delete;
+    SharedTriangleSink& operator=(const SharedTriangleSink&) = delete;
+
+    // Begin a pass consuming into target through numWriters writers, discarding the triangles it holds
+    void start(TriangleConsumer<VertexType>& target, size_t numWriters)
+    {
+        assert(!_active && "SharedTriangleSink::start() called before the previous pass was committed");
+        _active = true;
+
+        _target = &target;
+        _vertices = std::move(_target->_vertices);
+        _target->_vertices.clear();
+        _target->_numTriangles = 0;
+        _vertices.resize(_capacity);
+        _size = 0;
+        _overflow.clear();
+
+        _writers.assign(numWriters, Writer {});
+        for (auto& writer : _writers) {
+            writer._sink = this;
+        }
+    }
+
+    // Preallocate room for at least numTriangles from the next start(); like the room
+    // large passes need, it's released over the following smaller passes
+    void reserve(size_t numTriangles)
+    {
+        _capacity = std::max(_capacity, numTriangles * 3);
+    }
+
+    // Writer i of those start() made; each may only be used by one thread at a time
+    Writer& writer(size_t i) { return _writers[i]; }
+
+    // Append the triangles batch has consumed, reserving room for all of them at once
+    void add(const TriangleConsumer<VertexType>& batch)
+    {
+        const auto& vertices = batch.getVertices();
+        if (vertices.empty()) {
+            return;
+        }
+
+        const size_t offset = _size.fetch_add(vertices.size(), std::memory_order_relaxed);
+        if (offset + vertices.size() <= _vertices.size()) {
+            std::copy(vertices.begin(), vertices.end(), _vertices.begin() + offset);
+        } else {
+            std::lock_guard<std::mutex> lock(_overflowMutex);
+            _overflow.push_back(Overflow { offset, vertices });
+        }
+    }
+
+    // Complete the pass; the target then holds every triangle written & added
+    void commit()
+    {
+        auto& vertices = _vertices;
+        const size_t reserved = _size.load();
+        if (vertices.size() < reserved) {
+            vertices.resize(reserved);
+        }
+        for (const auto& overflow : _overflow) {
+            std::copy(overflow.vertices.begin(), overflow.vertices.end(), vertices.begin() + overflow.offset);
+        }
+        _overflow.clear();
+
+        // the unwritten tails of the writers' last blocks
+        struct Hole {
+            size_t begin, end;
+        };
+        std::vector<Hole> holes;
+        for (const auto& writer : _writers) {
+            if (writer._block && writer._next != writer._end) {
+                const size_t written = writer._next - writer._block;
+                holes.push_back(Hole { writer._blockOffset + written, writer._blockOffset + kBlockTriangles * 3 });
+            }
+        }
+        std::sort(holes.begin(), holes.end(), [](const Hole& a, const Hole& b) {
+            return a.begin < b.begin;
+        });
+
+        // drop holes at the end of the mesh, and fill the first of the rest from its end
+        size_t size = reserved;
+        while (!holes.empty()) {
+            const auto last = holes.back();
+            if (last.end >= size) {
+                size = std::min(size, last.begin);
+                holes.pop_back();
+                continue;
+            }
+
+            auto& first = holes.front();
+            const size_t n = std::min(first.end - first.begin, size - last.end);
+            std::copy(vertices.begin() + (size - n), vertices.begin() + size, vertices.begin() + first.begin);
+            first.begin += n;
+            size -= n;
+            if (first.begin == first.end) {
+                holes.erase(holes.begin());
+            }
+        }
+
+        // size the next pass for the largest recent one, decaying halfway toward
+        // this pass when it's smaller, and release storage well beyond that
+        _capacity = reserved >= _capacity ? reserved : _capacity - (_capacity - reserved) / 2;
+        vertices.resize(size);
+        if (vertices.capacity() > 2 * std::max(_capacity, size)) {
+            vertices.shrink_to_fit();
+        }
+
+        _target->_vertices = std::move(vertices);
+        _target->_numTriangles = size / 3;
+        vertices.clear();
+        _active = false;
+    }
+
+private:
+    struct Overflow {
+        size_t offset;
+        std::vector<VertexType> vertices;
+    };
+
+    void reserveBlock(Writer& writer)
     {
-        _gpuStorage.draw();
+        constexpr size_t kBlockVertices = kBlockTriangles * 3;
+        const size_t offset = _size.fetch_add(kBlockVertices, std::memory_order_relaxed);
+        writer._blockOffset = offset;
+        if (offset + kBlockVertices <= _vertices.size()) {
+            writer._block = _vertices.data() + offset;
+        } else {
+            std::lock_guard<std::mutex> lock(_overflowMutex);
+            _overflow.push_back(Overflow { offset, std::vector<VertexType>(kBlockVertices) });
+            writer._block = _overflow.back().vertices.data();
+        }
+        writer._next = writer._block;
+        writer._end = writer._block + kBlockVertices;
+    }
+
+    TriangleConsumer<VertexType>* _target = nullptr;
+    // the target's vertices, while a pass is in progress
+    std::vector<VertexType> _vertices;
+    size_t _capacity = 0;
+    std::atomic<size_t> _size { 0 };
+    std::atomic<bool> _active { false };
+    std::vector<Writer> _writers;
+    std::mutex _overflowMutex;
+    std::deque<Overflow> _overflow;
+};
+
+/*
+ Consumes triangles with indexed storage; a vertex shared by several
+ triangles is stored once. As with TriangleConsumer, only CPU-side buffers
+ are owned; see GpuIndexedTriangleConsumer for a drawable variant. Usage:
+    consumer.start();
+    for (...) {
+        auto a = consumer.addVertex(...);
+        auto b = consumer.addVertex(...);
+        auto c = consumer.addVertex(...);
+        consumer.addTriangle(a, b, c);
     }
+    consumer.finish();
+ */
+template <class VertexType>
+class IndexedTriangleConsumer {
+protected:
+    std::vector<VertexType> _vertices;
+    std::vector<uint32_t> _indices;
+
+public:
+    using vertex_type = VertexType;
+
+    IndexedTriangleConsumer() = default;
+    virtual ~IndexedTriangleConsumer() = default;
 
-    void clear()
+    void start()
     {
         _vertices.clear();
-        _gpuStorage.update({});
-        _numTriangles = 0;
+        _indices.clear();
+    }
+
+    // Add a vertex, returning its index for use with addTriangle
+    uint32_t addVertex(const VertexType& v)
+    {
+        _vertices.push_back(v);
+        return static_cast<uint32_t>(_vertices.size() - 1);
+    }
+
+    void addTriangle(uint32_t a, uint32_t b, uint32_t c)
+    {
+        _indices.push_back(a);
+        _indices.push_back(b);
+        _indices.push_back(c);
     }
 
-    const auto& getStorage() const { return _gpuStorage; }
-    auto& getStorage() { return _gpuStorage; }
+    // Called when a march pass completes; subclasses may publish the vertices & indices
+    virtual void finish()
+    {
+    }
+
+    size_t getNumTriangles() const { return _indices.size() / 3; }
+    size_t getNumVertices() const { return _vertices.size(); }
+
+    VertexType& getVertex(uint32_t i) { return _vertices[i]; }
+    const VertexType& getVertex(uint32_t i) const { return _vertices[i]; }
+
+    const std::vector<VertexType>& getVertices() const { return _vertices; }
+    const std::vector<uint32_t>& getIndices() const { return _indices; }
+
+    virtual void clear()
+    {
+        _vertices.clear();
+        _indices.clear();
+    }
 };
 
 } // namespace mc
@@ -0,0 +1,49 @@
+#ifndef mc_util_core_h
+#define mc_util_core_h
+
+// GL-free subset of util.hpp; safe to include from headless builds
+
+#include <cstdint>
+#include <limits>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define GLM_FORCE_RADIANS
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/gtx/hash.hpp>
+#include <glm/gtx/norm.hpp>
+
+#include "aabb.hpp"
+#include "thread_pool.hpp"
+#include "unowned_ptr.hpp"
+
+namespace mc {
+namespace util {
+
+    // index of the lowest set bit of x, which must be non-zero
+    inline int CountTrailingZeros(uint64_t x)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(x);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+        unsigned long index;
+        _BitScanForward64(&index, x);
+        return static_cast<int>(index);
+#else
+        int index = 0;
+        for (; !(x & 1); x >>= 1) {
+            index++;
+        }
+        return index;
+#endif
+    }
+
+}
+} // namespace mc::util
+
+#endif /* mc_util_core_h */
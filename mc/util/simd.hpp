@@ -0,0 +1,161 @@
+#ifndef mc_simd_h
+#define mc_simd_h
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <cmath>
+
+namespace mc {
+namespace util {
+    namespace simd {
+
+        /**
+         * Minimal wrapper over the widest float vector available to the compiler:
+         * AVX (8 lanes) when building with -mavx/-mavx2, SSE (4 lanes) on x86_64,
+         * and a single scalar lane otherwise. Comparisons return a floatv with all
+         * bits set in lanes where the comparison holds, for use with select() and
+         * movemask(). Loads & stores are unaligned.
+         */
+        struct floatv;
+
+#if defined(__AVX__)
+
+        struct floatv {
+            static constexpr int width = 8;
+            __m256 v;
+
+            floatv() = default;
+            floatv(__m256 v)
+                : v(v)
+            {
+            }
+            floatv(float s)
+                : v(_mm256_set1_ps(s))
+            {
+            }
+
+            static floatv load(const float* p) { return _mm256_loadu_ps(p); }
+            void store(float* p) const { _mm256_storeu_ps(p, v); }
+        };
+
+        inline floatv operator+(floatv a, floatv b) { return _mm256_add_ps(a.v, b.v); }
+        inline floatv operator-(floatv a, floatv b) { return _mm256_sub_ps(a.v, b.v); }
+        inline floatv operator*(floatv a, floatv b) { return _mm256_mul_ps(a.v, b.v); }
+        inline floatv operator/(floatv a, floatv b) { return _mm256_div_ps(a.v, b.v); }
+        inline floatv operator-(floatv a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0F)); }
+        inline floatv min(floatv a, floatv b) { return _mm256_min_ps(a.v, b.v); }
+        inline floatv max(floatv a, floatv b) { return _mm256_max_ps(a.v, b.v); }
+        inline floatv sqrt(floatv a) { return _mm256_sqrt_ps(a.v); }
+        inline floatv abs(floatv a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0F), a.v); }
+
+        inline floatv operator<(floatv a, floatv b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+        inline floatv operator<=(floatv a, floatv b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+        inline floatv operator>(floatv a, floatv b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+        inline floatv operator>=(floatv a, floatv b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+        inline floatv operator&(floatv a, floatv b) { return _mm256_and_ps(a.v, b.v); }
+        inline floatv operator|(floatv a, floatv b) { return _mm256_or_ps(a.v, b.v); }
+
+        // returns a where mask is set, b elsewhere
+        inline floatv select(floatv mask, floatv a, floatv b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+
+        // returns a bitmask with bit i set iff lane i of mask is set
+        inline int movemask(floatv mask) { return _mm256_movemask_ps(mask.v); }
+
+#elif defined(__SSE2__)
+
+        struct floatv {
+            static constexpr int width = 4;
+            __m128 v;
+
+            floatv() = default;
+            floatv(__m128 v)
+                : v(v)
+            {
+            }
+            floatv(float s)
+                : v(_mm_set1_ps(s))
+            {
+            }
+
+            static floatv load(const float* p) { return _mm_loadu_ps(p); }
+            void store(float* p) const { _mm_storeu_ps(p, v); }
+        };
+
+        inline floatv operator+(floatv a, floatv b) { return _mm_add_ps(a.v, b.v); }
+        inline floatv operator-(floatv a, floatv b) { return _mm_sub_ps(a.v, b.v); }
+        inline floatv operator*(floatv a, floatv b) { return _mm_mul_ps(a.v, b.v); }
+        inline floatv operator/(floatv a, floatv b) { return _mm_div_ps(a.v, b.v); }
+        inline floatv operator-(floatv a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0F)); }
+        inline floatv min(floatv a, floatv b) { return _mm_min_ps(a.v, b.v); }
+        inline floatv max(floatv a, floatv b) { return _mm_max_ps(a.v, b.v); }
+        inline floatv sqrt(floatv a) { return _mm_sqrt_ps(a.v); }
+        inline floatv abs(floatv a) { return _mm_andnot_ps(_mm_set1_ps(-0.0F), a.v); }
+
+        inline floatv operator<(floatv a, floatv b) { return _mm_cmplt_ps(a.v, b.v); }
+        inline floatv operator<=(floatv a, floatv b) { return _mm_cmple_ps(a.v, b.v); }
+        inline floatv operator>(floatv a, floatv b) { return _mm_cmpgt_ps(a.v, b.v); }
+        inline floatv operator>=(floatv a, floatv b) { return _mm_cmpge_ps(a.v, b.v); }
+        inline floatv operator&(floatv a, floatv b) { return _mm_and_ps(a.v, b.v); }
+        inline floatv operator|(floatv a, floatv b) { return _mm_or_ps(a.v, b.v); }
+
+        // returns a where mask is set, b elsewhere
+        inline floatv select(floatv mask, floatv a, floatv b)
+        {
+            return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+        }
+
+        // returns a bitmask with bit i set iff lane i of mask is set
+        inline int movemask(floatv mask) { return _mm_movemask_ps(mask.v); }
+
+#else
+
+        struct floatv {
+            static constexpr int width = 1;
+            float v;
+
+            floatv() = default;
+            floatv(float s)
+                : v(s)
+            {
+            }
+
+            static floatv load(const float* p) { return *p; }
+            void store(float* p) const { *p = v; }
+        };
+
+        // masks are represented as 1 (set) or 0 (clear)
+        inline floatv operator+(floatv a, floatv b) { return a.v + b.v; }
+        inline floatv operator-(floatv a, floatv b) { return a.v - b.v; }
+        inline floatv operator*(floatv a, floatv b) { return a.v * b.v; }
+        inline floatv operator/(floatv a, floatv b) { return a.v / b.v; }
+        inline floatv operator-(floatv a) { return -a.v; }
+        inline floatv min(floatv a, floatv b) { return b.v < a.v ? b.v : a.v; }
+        inline floatv max(floatv a, floatv b) { return b.v > a.v ? b.v : a.v; }
+        inline floatv sqrt(floatv a) { return std::sqrt(a.v); }
+        inline floatv abs(floatv a) { return std::abs(a.v); }
+
+        inline floatv operator<(floatv a, floatv b) { return a.v < b.v ? 1.0F : 0.0F; }
+        inline floatv operator<=(floatv a, floatv b) { return a.v <= b.v ? 1.0F : 0.0F; }
+        inline floatv operator>(floatv a, floatv b) { return a.v > b.v ? 1.0F : 0.0F; }
+        inline floatv operator>=(floatv a, floatv b) { return a.v >= b.v ? 1.0F : 0.0F; }
+        inline floatv operator&(floatv a, floatv b) { return (a.v != 0 && b.v != 0) ? 1.0F : 0.0F; }
+        inline floatv operator|(floatv a, floatv b) { return (a.v != 0 || b.v != 0) ? 1.0F : 0.0F; }
+
+        inline floatv select(floatv mask, floatv a, floatv b) { return mask.v != 0 ? a : b; }
+        inline int movemask(floatv mask) { return mask.v != 0 ? 1 : 0; }
+
+#endif
+
+        // operand order matches the scalar code paths: (x*x + y*y) + z*z
+        inline floatv dot(floatv ax, floatv ay, floatv az, floatv bx, floatv by, floatv bz)
+        {
+            return ax * bx + ay * by + az * bz;
+        }
+
+    }
+}
+} // namespace mc::util::simd
+
+#endif /* mc_simd_h */
@@ -15,8 +15,11 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/norm.hpp>
 
+#include <cstdint>
 #include <vector>
 
+#include "io.hpp"
+
 namespace mc {
 namespace util {
 
@@ -93,22 +96,28 @@ namespace util {
         std::size_t getVertexStoreSize() const { return _vertexStorageSize; }
 
         void update(const std::vector<VertexType>& vertices)
+        {
+            update(vertices.data(), vertices.size());
+        }
+
+        // upload numVertices vertices directly from memory, e.g., a memory-mapped file
+        void update(const VertexType* vertices, std::size_t numVertices)
         {
             if (_vao == 0) {
                 glGenVertexArrays(1, &_vao);
             }
             glBindVertexArray(_vao);
-            _updateVertices(vertices);
+            _updateVertices(vertices, numVertices);
             glBindVertexArray(0);
         }
 
     private:
-        void _updateVertices(const std::vector<VertexType>& vertices)
+        void _updateVertices(const VertexType* vertices, std::size_t numVertices)
         {
             CHECK_GL_ERROR("VertexStorage::_updateVertices enter");
-            if (vertices.size() > _vertexStorageSize) {
-                _vertexStorageSize = static_cast<std::size_t>(vertices.size() * _growthFactor);
-                _numVertices = vertices.size();
+            if (numVertices > _vertexStorageSize) {
+                _vertexStorageSize = static_cast<std::size_t>(numVertices * _growthFactor);
+                _numVertices = numVertices;
 
                 if (_vertexVboId > 0) {
                     glDeleteBuffers(1, &_vertexVboId);
@@ -124,26 +133,138 @@ namespace util {
                     nullptr,
                     GL_STREAM_DRAW);
 
-                glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(VertexType) * _numVertices, vertices.data());
+                glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(VertexType) * _numVertices, vertices);
 
                 VertexType::bindVertexAttributes();
 
             } else {
                 // GPU storage suffices, just copy data over
-                _numVertices = vertices.size();
+                _numVertices = numVertices;
                 if (_numVertices > 0) {
                     glBindBuffer(GL_ARRAY_BUFFER, _vertexVboId);
                     glBufferSubData(
                         GL_ARRAY_BUFFER,
                         0,
                         sizeof(VertexType) * _numVertices,
-                        vertices.data());
+                        vertices);
                 }
             }
             CHECK_GL_ERROR("VertexStorage::_updateVertices exit");
         }
     };
 
+    /**
+     * Indexed GPU storage templated on vertex type; draws with glDrawElements
+     * using uint32 indices. Has the same VertexType requirements as VertexStorage.
+     */
+    template <class VertexType>
+    class IndexedVertexStorage {
+    private:
+        GLenum _mode;
+        GLuint _vertexVboId = 0;
+        GLuint _indexVboId = 0;
+        GLuint _vao = 0;
+        std::size_t _numVertices = 0;
+        std::size_t _numIndices = 0;
+        std::size_t _vertexStorageSize = 0;
+        std::size_t _indexStorageSize = 0;
+        float _growthFactor;
+
+    public:
+        IndexedVertexStorage(GLenum mode, float growthFactor = 1.5F)
+            : _mode(mode)
+            , _growthFactor(growthFactor)
+        {
+        }
+
+        ~IndexedVertexStorage()
+        {
+            if (_vao > 0)
+                glDeleteVertexArrays(1, &_vao);
+            if (_vertexVboId > 0)
+                glDeleteBuffers(1, &_vertexVboId);
+            if (_indexVboId > 0)
+                glDeleteBuffers(1, &_indexVboId);
+        }
+
+        void draw() const
+        {
+            if (_vao > 0 && _numIndices > 0) {
+                CHECK_GL_ERROR("IndexedVertexStorage::draw enter");
+                glBindVertexArray(_vao);
+                glDrawElements(_mode, static_cast<GLsizei>(_numIndices), GL_UNSIGNED_INT, nullptr);
+                glBindVertexArray(0);
+                CHECK_GL_ERROR("IndexedVertexStorage::draw exit");
+            }
+        }
+
+        std::size_t getNumVertices() const { return _numVertices; }
+        std::size_t getNumIndices() const { return _numIndices; }
+        std::size_t getVertexStoreSize() const { return _vertexStorageSize; }
+        std::size_t getIndexStoreSize() const { return _indexStorageSize; }
+
+        void update(const std::vector<VertexType>& vertices, const std::vector<uint32_t>& indices)
+        {
+            if (_vao == 0) {
+                glGenVertexArrays(1, &_vao);
+            }
+            glBindVertexArray(_vao);
+            _updateVertices(vertices);
+            _updateIndices(indices);
+            glBindVertexArray(0);
+        }
+
+    private:
+        void _updateVertices(const std::vector<VertexType>& vertices)
+        {
+            CHECK_GL_ERROR("IndexedVertexStorage::_updateVertices enter");
+            _numVertices = vertices.size();
+            if (vertices.size() > _vertexStorageSize) {
+                _vertexStorageSize = static_cast<std::size_t>(vertices.size() * _growthFactor);
+
+                if (_vertexVboId > 0) {
+                    glDeleteBuffers(1, &_vertexVboId);
+                    _vertexVboId = 0;
+                }
+
+                glGenBuffers(1, &_vertexVboId);
+                glBindBuffer(GL_ARRAY_BUFFER, _vertexVboId);
+                glBufferData(GL_ARRAY_BUFFER, sizeof(VertexType) * _vertexStorageSize, nullptr, GL_STREAM_DRAW);
+                glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(VertexType) * _numVertices, vertices.data());
+
+                VertexType::bindVertexAttributes();
+            } else if (_numVertices > 0) {
+                glBindBuffer(GL_ARRAY_BUFFER, _vertexVboId);
+                glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(VertexType) * _numVertices, vertices.data());
+            }
+            CHECK_GL_ERROR("IndexedVertexStorage::_updateVertices exit");
+        }
+
+        void _updateIndices(const std::vector<uint32_t>& indices)
+        {
+            CHECK_GL_ERROR("IndexedVertexStorage::_updateIndices enter");
+            _numIndices = indices.size();
+            if (indices.size() > _indexStorageSize) {
+                _indexStorageSize = static_cast<std::size_t>(indices.size() * _growthFactor);
+
+                if (_indexVboId > 0) {
+                    glDeleteBuffers(1, &_indexVboId);
+                    _indexVboId = 0;
+                }
+
+                // the element array binding is VAO state, so this is captured by _vao
+                glGenBuffers(1, &_indexVboId);
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexVboId);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * _indexStorageSize, nullptr, GL_STREAM_DRAW);
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(uint32_t) * _numIndices, indices.data());
+            } else if (_numIndices > 0) {
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexVboId);
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(uint32_t) * _numIndices, indices.data());
+            }
+            CHECK_GL_ERROR("IndexedVertexStorage::_updateIndices exit");
+        }
+    };
+
 }
 } // namespace mc::util
 
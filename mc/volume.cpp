@@ -6,8 +6,11 @@
 //  Copyright © 2020 Shamyl Zakariya. All rights reserved.
 //
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <iostream>
+#include <limits>
 
 #include "util/op_queue.hpp"
 #include "volume.hpp"
@@ -17,6 +20,33 @@ using namespace glm;
 namespace mc {
 
 namespace {
+    using Clock = std::chrono::steady_clock;
+
+    double SecondsBetween(Clock::time_point start, Clock::time_point end)
+    {
+        return std::chrono::duration<double>(end - start).count();
+    }
+
+    // a node's 6 faces and 12 edges, indexed as MarchOptions::neighborStrides & edgeNeighborStrides
+    constexpr int kNumAdjacencies = 18;
+
+    // direction from a node's center toward the given face or edge
+    ivec3 AdjacencyDirection(int adjacency)
+    {
+        ivec3 direction(0);
+        if (adjacency < 6) {
+            direction[adjacency / 2] = adjacency % 2 ? 1 : -1;
+        } else {
+            const int edge = adjacency - 6;
+            const int axis = edge / 4;
+            const int lower = axis == 0 ? 1 : 0;
+            const int higher = axis == 2 ? 1 : 2;
+            direction[lower] = edge & 2 ? 1 : -1;
+            direction[higher] = edge & 1 ? 1 : -1;
+        }
+        return direction;
+    }
+
     OctreeVolume::Node* findChildContaining(OctreeVolume::Node* node, const glm::vec3& p)
     {
         // TODO: This can be optimized by checking which quadrant the point
@@ -28,6 +58,121 @@ namespace {
         }
         return nullptr;
     }
+
+    /*
+    Value sampler over a node's additive and subtractive samplers, combining their
+    contributions. Offers both the per-point and batched call forms consumed by
+    mc::march; the batched form hands each plane to IVolumeSampler::valuesAt.
+    */
+    class CompositeSampler {
+    public:
+        CompositeSampler(const std::vector<IVolumeSampler*>& additiveSamplers,
+            const std::vector<IVolumeSampler*>& subtractiveSamplers,
+            float fuzziness)
+            : _additiveSamplers(additiveSamplers)
+            , _subtractiveSamplers(subtractiveSamplers)
+            , _fuzziness(fuzziness)
+        {
+        }
+
+        float operator()(const vec3& p, MaterialState& material) const
+        {
+            // run additive samplers, interpolating
+            // material state
+            float value = 0;
+            for (auto additiveSampler : _additiveSamplers) {
+                MaterialState m;
+                auto v = additiveSampler->valueAt(p, _fuzziness, m);
+                if (value == 0) {
+                    material = m;
+                } else {
+                    material = mix(material, m, v);
+                }
+                value += v;
+            }
+
+            // run subtractions (these don't affect material state)
+            value = min<float>(value, 1.0F);
+            for (auto subtractiveSampler : _subtractiveSamplers) {
+                MaterialState _;
+                value -= subtractiveSampler->valueAt(p, _fuzziness, _);
+            }
+            value = max<float>(value, 0.0F);
+
+            return value;
+        }
+
+        void operator()(const float* xs, const float* ys, const float* zs, std::size_t n,
+            float* values, MaterialState* materials) const
+        {
+            _scratchValues.resize(n);
+            if (_additiveSamplers.empty()) {
+                std::fill(values, values + n, 0.0F);
+                return;
+            }
+
+            // the first sampler's values & materials are taken as they are, as
+            // the per-point form does; materials arrive in their default state
+            _additiveSamplers.front()->valuesAt(xs, ys, zs, n, _fuzziness, values, materials);
+
+            _scratchMaterials.resize(n);
+            for (std::size_t s = 1; s < _additiveSamplers.size(); s++) {
+                std::fill(_scratchMaterials.begin(), _scratchMaterials.end(), MaterialState {});
+                _additiveSamplers[s]->valuesAt(xs, ys, zs, n, _fuzziness, _scratchValues.data(), _scratchMaterials.data());
+                for (std::size_t i = 0; i < n; i++) {
+                    const auto v = _scratchValues[i];
+                    if (values[i] == 0) {
+                        materials[i] = _scratchMaterials[i];
+                    } else {
+                        materials[i] = mix(materials[i], _scratchMaterials[i], v);
+                    }
+                    values[i] += v;
+                }
+            }
+
+            for (std::size_t i = 0; i < n; i++) {
+                values[i] = min<float>(values[i], 1.0F);
+            }
+
+            // subtractions don't affect material state
+            for (auto subtractiveSampler : _subtractiveSamplers) {
+                subtractiveSampler->valuesAt(xs, ys, zs, n, _fuzziness, _scratchValues.data(), nullptr);
+                for (std::size_t i = 0; i < n; i++) {
+                    values[i] -= _scratchValues[i];
+                }
+            }
+
+            for (std::size_t i = 0; i < n; i++) {
+                values[i] = max<float>(values[i], 0.0F);
+            }
+        }
+
+        // every sampler's value & material are constant within the returned distance of p
+        float distanceBound(const vec3& p) const
+        {
+            float bound = std::numeric_limits<float>::max();
+            for (const auto& samplers : { &_additiveSamplers, &_subtractiveSamplers }) {
+                for (auto sampler : *samplers) {
+                    bound = min(bound, sampler->distanceBound(p, _fuzziness));
+                    if (bound <= kDistanceBoundMargin) {
+                        return 0;
+                    }
+                }
+            }
+
+            return bound - kDistanceBoundMargin;
+        }
+
+    private:
+        // absorbs float error in the samplers' distances, which are computed relative to their origins
+        static constexpr float kDistanceBoundMargin = 1e-2F;
+
+        const std::vector<IVolumeSampler*>& _additiveSamplers;
+        const std::vector<IVolumeSampler*>& _subtractiveSamplers;
+        float _fuzziness;
+        mutable std::vector<float> _scratchValues;
+        mutable std::vector<MaterialState> _scratchMaterials;
+    };
 }
 
 mc::util::unowned_ptr<OctreeVolume::Node>
@@ -54,9 +199,7 @@ OctreeVolume::findNode(const glm::vec3& point) const
 void OctreeVolume::march(
     std::function<void(OctreeVolume::Node*)> marchedNodeObserver)
 {
-    for (auto& tc : _triangleConsumers) {
-        tc->start();
-    }
+    startTriangleConsumers();
 
     marchSetup();
 
@@ -64,15 +207,24 @@ void OctreeVolume::march(
     // we need to make a copy since marchCollectedNodes
     // drains _nodesToMarch
     if (marchedNodeObserver) {
-        _marchedNodes = _nodesToMarch;
+        _marchedNodes = _incrementalMarching ? _occupiedNodes : _nodesToMarch;
     }
 
+    const auto marchStart = Clock::now();
     auto jobs = marchCollectedNodes();
 
     // blocking wait
     for (auto& j : jobs) {
         j.wait();
     }
+    if (_incrementalMarching) {
+        gatherNodeGeometry();
+    }
+    if (_sharedTriangles) {
+        _sharedTriangles->commit();
+    }
+    _marchStats.marchSeconds = SecondsBetween(marchStart, Clock::now());
+    _lastMarchStats = _marchStats;
 
     for (auto& tc : _triangleConsumers) {
         tc->finish();
@@ -92,14 +244,14 @@ void OctreeVolume::marchAsync(
 {
     _marching = true;
 
-    for (auto& tc : _triangleConsumers) {
-        tc->start();
-    }
+    startTriangleConsumers();
 
     _asyncMarchId++;
     auto id = _asyncMarchId;
 
-    _asyncWaiter = _threadPool->enqueue(
+    // No pool thread ever blocks waiting on another job; the last march job to
+    // finish completes the pass. This lets many volumes share one ThreadPool.
+    _threadPool->enqueue(
         [this, onReady, marchedNodeObserver, id](int _) {
             // collect the nodes to march
             marchSetup();
@@ -107,49 +259,200 @@ void OctreeVolume::marchAsync(
             // if caller needs the marched nodes, we need
             // to make a copy
             if (marchedNodeObserver) {
-                _marchedNodes = _nodesToMarch;
+                _marchedNodes = _incrementalMarching ? _occupiedNodes : _nodesToMarch;
             }
 
             // march the collected nodes
-            auto jobs = marchCollectedNodes();
+            const auto marchStart = Clock::now();
+            marchCollectedNodes([this, onReady, marchedNodeObserver, id, marchStart]() {
+                if (_incrementalMarching) {
+                    gatherNodeGeometry();
+                }
+                if (_sharedTriangles) {
+                    _sharedTriangles->commit();
+                }
+                _marchStats.marchSeconds = SecondsBetween(marchStart, Clock::now());
 
-            // wait on the march job
-            for (auto& j : jobs) {
-                j.wait();
-            }
+                _marching = false;
 
-            _marching = false;
+                if (id != _asyncMarchId) {
+                    // looks like a new march got queued before this one
+                    // finished, so bail on this pass
+                    std::cerr << "[OctreeVolume::marchAsync] - expected id: "
+                              << id << " but current asyncMarchId is: "
+                              << _asyncMarchId << " bailing." << std::endl;
 
-            if (id != _asyncMarchId) {
-                // looks like a new march got queued before this one
-                // finished, so bail on this pass
-                std::cerr << "[OctreeVolume::marchAsync] - waitPool - expected id: "
-                          << id << " but current asyncMarchId is: "
-                          << _asyncMarchId << " bailing." << std::endl;
+                    return;
+                }
 
-                return;
-            }
+                _lastMarchStats = _marchStats;
 
-            util::MainThreadQueue()->add([this, onReady, marchedNodeObserver]() {
-                for (auto& tc : _triangleConsumers) {
-                    tc->finish();
-                }
-                onReady();
+                util::MainThreadQueue()->add([this, onReady, marchedNodeObserver]() {
+                    for (auto& tc : _triangleConsumers) {
+                        tc->finish();
+                    }
 
-                // if we hav an observer, pass collected march nodes to it
-                if (marchedNodeObserver) {
-                    for (const auto& node : _marchedNodes) {
-                        marchedNodeObserver(node);
+                    // if we hav an observer, pass collected march nodes to it
+                    if (marchedNodeObserver) {
+                        for (const auto& node : _marchedNodes) {
+                            marchedNodeObserver(node);
+                        }
                     }
-                }
+
+                    onReady();
+                });
             });
         });
 }
 
+void OctreeVolume::setIncrementalMarching(bool incremental)
+{
+    if (incremental == _incrementalMarching) {
+        return;
+    }
+
+    _incrementalMarching = incremental;
+    for (auto node : _occupiedNodes) {
+        node->_geometry.reset();
+    }
+    _occupiedNodes.clear();
+    _dirtySamplers.clear();
+
+    // node dirtiness isn't tracked when not incremental, so everything must be re-marked
+    walkOctree([](Node* node) {
+        node->_dirty = true;
+        return true;
+    });
+}
+
+void OctreeVolume::setAdaptiveMarching(bool adaptive, int maxStride, float tolerance)
+{
+    _adaptiveMarching = adaptive;
+    _adaptiveMaxStride = std::max(maxStride, 1);
+    _adaptiveTolerance = std::max(tolerance, 0.0F);
+
+    // every node's detail must be re-estimated
+    walkOctree([](Node* node) {
+        node->_detailStride = 0;
+        return true;
+    });
+}
+
+void OctreeVolume::setMarchOptions(const MarchOptions& options)
+{
+    const bool marginChanged = _extractor == Extractor::SurfaceNets && options.stride != _marchOptions.stride;
+    _marchOptions = options;
+
+    // the margin of cells surface nets reads past each node is a stride wide, so
+    // the samplers each node sees must be re-marked
+    if (marginChanged) {
+        walkOctree([](Node* node) {
+            node->_dirty = true;
+            return true;
+        });
+    }
+}
+
+void OctreeVolume::setExtractor(Extractor extractor)
+{
+    if (extractor == _extractor) {
+        return;
+    }
+
+    _extractor = extractor;
+
+    // samplingBounds() changed
+    walkOctree([](Node* node) {
+        node->_dirty = true;
+        return true;
+    });
+}
+
+void OctreeVolume::notifyChanged(util::unowned_ptr<IVolumeSampler> sampler, const util::AABB& oldBounds)
+{
+    if (!_incrementalMarching) {
+        return;
+    }
+
+    _dirtySamplers.insert(sampler.get());
+
+    // dirty the nodes the sampler affected before and after the change
+    walkOctree([this, &sampler, &oldBounds](Node* node) {
+        const auto bounds = samplingBounds(node);
+        if (bounds.intersect(oldBounds) != util::AABB::Intersection::Outside
+            || node->additiveSamplers.count(sampler.get())
+            || node->subtractiveSamplers.count(sampler.get())
+            || sampler->intersects(bounds)) {
+            node->_dirty = true;
+            return true;
+        }
+        return false;
+    });
+}
+
+void OctreeVolume::onSamplerAdded(IVolumeSampler* sampler)
+{
+    if (!_incrementalMarching) {
+        return;
+    }
+
+    // a new sampler may reuse the address of a removed one, so force
+    // the nodes it lands in to re-march
+    _dirtySamplers.insert(sampler);
+
+    walkOctree([this, sampler](Node* node) {
+        if (sampler->intersects(samplingBounds(node))) {
+            node->_dirty = true;
+            return true;
+        }
+        return false;
+    });
+}
+
+void OctreeVolume::onSamplerRemoved(IVolumeSampler* sampler)
+{
+    // Drop the sampler from the nodes referencing it, so Node::valueAt won't touch it once
+    // destroyed. A node referencing an additive sampler implies its parent does too, but
+    // subtractive samplers are tested with intersection(), which needn't hold for a parent
+    // when it holds for a child, so for those every occupied node is visited.
+    const bool subtractive = sampler->getMode() == IVolumeSampler::Mode::Subtractive;
+    walkOctree([this, sampler, subtractive](Node* node) {
+        const bool referenced = node->additiveSamplers.erase(sampler) + node->subtractiveSamplers.erase(sampler) > 0;
+        if (referenced) {
+            node->_additiveSamplersVec.clear();
+            node->_subtractiveSamplersVec.clear();
+        }
+
+        // a subtractive sampler containing a node empties it without being referenced by it
+        const bool affected = referenced || (_incrementalMarching && sampler->intersects(samplingBounds(node)));
+        if (affected) {
+            node->_dirty = true;
+        }
+        return affected || (subtractive && !node->empty);
+    });
+}
+
+void OctreeVolume::startTriangleConsumers()
+{
+    if (_sharedTriangles) {
+        _sharedTriangles->start(*_triangleConsumers.front(), _threadPool->size());
+        return;
+    }
+
+    for (auto& tc : _triangleConsumers) {
+        tc->start();
+    }
+}
+
 void OctreeVolume::marchSetup()
 {
+    _marchStats = MarchStats {};
     _nodesToMarch.clear();
-    collect(_nodesToMarch);
+
+    const auto markStart = Clock::now();
+    mark(_root.get());
+    const auto collectStart = Clock::now();
+    collect(_root.get(), _nodesToMarch);
 
     // collapse each node's set of samplers to a vector for faster iteration when marching
     for (const auto& node : _nodesToMarch) {
@@ -164,61 +467,513 @@ void OctreeVolume::marchSetup()
             std::end(node->subtractiveSamplers),
             std::back_inserter(node->_subtractiveSamplersVec));
     }
+
+    assignNodeMarchOptions();
+
+    if (_incrementalMarching) {
+        updateNodeGeometryCaches();
+    }
+
+    for (const auto& node : _nodesToMarch) {
+        const auto size = ivec3(node->bounds.size());
+        const auto cells = detail::Lattice(util::iAABB(node->bounds), node->_marchOptions.stride).cells();
+        const auto latticePoints = static_cast<std::size_t>((cells.x + 1) * (cells.y + 1) * (cells.z + 1));
+        const auto numSamplers = node->_additiveSamplersVec.size() + node->_subtractiveSamplersVec.size();
+        _marchStats.voxels += static_cast<std::size_t>(size.x * size.y * size.z);
+        _marchStats.samplerEvaluations += latticePoints * numSamplers;
+    }
+
+    _marchStats.nodesMarched = _nodesToMarch.size();
+    _marchStats.markSeconds = SecondsBetween(markStart, collectStart);
+    _marchStats.collectSeconds = SecondsBetween(collectStart, Clock::now());
 }
 
-std::vector<std::future<void>> OctreeVolume::marchCollectedNodes()
+bool OctreeVolume::samplersChanged(const Node* node) const
 {
-    std::vector<std::future<void>> jobs;
-    for (std::size_t i = 0, N = _threadPool->size(); i < N; i++) {
-        jobs.push_back(_threadPool->enqueue([this, N](int threadIdx) {
-            while (true) {
-                Node* node = nullptr;
-                {
-                    std::lock_guard<std::mutex> popLock(_queuePopMutex);
-                    if (_nodesToMarch.empty()) {
-                        // we're done, exit the loop
-                        return;
+    if (!node->_geometry
+        || node->additiveSamplers != node->_geometryAdditiveSamplers
+        || node->subtractiveSamplers != node->_geometrySubtractiveSamplers) {
+        return true;
+    }
+
+    for (auto sampler : _dirtySamplers) {
+        if (node->additiveSamplers.count(sampler) || node->subtractiveSamplers.count(sampler)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool OctreeVolume::needsMarch(const Node* node) const
+{
+    return samplersChanged(node) || node->_marchOptions != node->_geometryMarchOptions;
+}
+
+void OctreeVolume::assignNodeMarchOptions()
+{
+    const int baseStride = std::max(_marchOptions.stride, 1);
+    const auto volumeBounds = util::iAABB(_bounds);
+
+    // surface nets can't stitch nodes of differing stride
+    const bool adaptive = _adaptiveMarching && _extractor == Extractor::MarchingCubes;
+
+    // For each face & edge (see MarchOptions), whether it lies on the volume's
+    // bounds, and if so the stride of the volume's neighbor across it
+    const auto volumeNeighborStride = [this, &volumeBounds](const Node* node, int adjacency, bool& onBounds) {
+        const auto bounds = util::iAABB(node->bounds);
+        const auto direction = AdjacencyDirection(adjacency);
+        int axesOnBounds = 0, axes = 0;
+        for (int a = 0; a < 3; a++) {
+            if (direction[a]) {
+                axes++;
+                axesOnBounds += direction[a] > 0 ? bounds.max[a] == volumeBounds.max[a] : bounds.min[a] == volumeBounds.min[a];
+            }
+        }
+
+        onBounds = axesOnBounds > 0;
+        if (axesOnBounds < axes) {
+            // an edge with only one face on the bounds; that face is stitched as a whole
+            return 0;
+        }
+        return adjacency < 6 ? _marchOptions.neighborStrides[adjacency] : _marchOptions.edgeNeighborStrides[adjacency - 6];
+    };
+
+    // pick each node's stride; nodes on the volume's bounds facing a neighbor
+    // keep the base stride, since that's what the neighbor is stitched to
+    for (auto node : _nodesToMarch) {
+        int stride = baseStride;
+        if (adaptive) {
+            const bool stale = !_incrementalMarching
+                || node->_detailStride == 0
+                || node->_detailBaseStride != baseStride
+                || _fuzziness != _geometryFuzziness
+                || samplersChanged(node);
+
+            if (stale) {
+                node->_detailStride = estimateStride(node);
+                node->_detailBaseStride = baseStride;
+            }
+
+            stride = node->_detailStride;
+            for (int a = 0; a < kNumAdjacencies; a++) {
+                bool onBounds = false;
+                if (volumeNeighborStride(node, a, onBounds) > 0) {
+                    stride = baseStride;
+                }
+            }
+        }
+        node->_marchOptions = _marchOptions;
+        node->_marchOptions.stride = stride;
+    }
+
+    // Find the neighbor across each face & edge which covers all of it, i.e., one at least
+    // as large. Those covered by several smaller neighbors need no stitching by this node,
+    // because once balanced, those neighbors are no coarser and stitch themselves to it.
+    std::vector<std::array<Node*, kNumAdjacencies>> neighbors(_nodesToMarch.size());
+    for (std::size_t i = 0, N = adaptive ? _nodesToMarch.size() : 0; i < N; i++) {
+        const auto node = _nodesToMarch[i];
+        const auto center = node->bounds.center();
+        const auto halfSize = node->bounds.size() * 0.5F;
+        for (int a = 0; a < kNumAdjacencies; a++) {
+            neighbors[i][a] = nullptr;
+            bool onBounds = false;
+            volumeNeighborStride(node, a, onBounds);
+            if (onBounds) {
+                continue;
+            }
+
+            const auto probe = center + vec3(AdjacencyDirection(a)) * (halfSize + 0.5F);
+            const auto neighbor = findMarchedNode(probe);
+            if (neighbor && neighbor->bounds.size().x >= node->bounds.size().x) {
+                neighbors[i][a] = neighbor;
+            }
+        }
+    }
+
+    // balance: a node may not be coarser than a larger neighbor covering one of its faces
+    // or edges. Neighbors of equal size simply stitch to whichever of them is coarser.
+    for (bool changed = adaptive; changed;) {
+        changed = false;
+        for (std::size_t i = 0, N = _nodesToMarch.size(); i < N; i++) {
+            const auto node = _nodesToMarch[i];
+            auto& options = node->_marchOptions;
+            for (auto neighbor : neighbors[i]) {
+                if (neighbor && neighbor->bounds.size().x > node->bounds.size().x && neighbor->_marchOptions.stride < options.stride) {
+                    options.stride = neighbor->_marchOptions.stride;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // finally, record the stride across each face & edge; when not adaptive,
+    // every node inside the volume borders nodes of the same stride
+    for (std::size_t i = 0, N = _nodesToMarch.size(); i < N; i++) {
+        const auto node = _nodesToMarch[i];
+        for (int a = 0; a < kNumAdjacencies; a++) {
+            bool onBounds = false;
+            int stride = volumeNeighborStride(node, a, onBounds);
+            if (!onBounds) {
+                stride = neighbors[i][a] ? neighbors[i][a]->_marchOptions.stride : 0;
+            }
+
+            if (a < 6) {
+                node->_marchOptions.neighborStrides[a] = stride;
+            } else {
+                node->_marchOptions.edgeNeighborStrides[a - 6] = stride;
+            }
+        }
+    }
+}
+
+int OctreeVolume::estimateStride(Node* node)
+{
+    constexpr float IsoLevel = 0.5F;
+    const int baseStride = std::max(_marchOptions.stride, 1);
+    const auto region = util::iAABB(node->bounds);
+    const int size = region.size().x;
+    const CompositeSampler valueSampler(node->_additiveSamplersVec, node->_subtractiveSamplersVec, _fuzziness);
+    const auto numSamplers = node->_additiveSamplersVec.size() + node->_subtractiveSamplersVec.size();
+
+    // Try the coarsest stride first, sampling the lattice at half the candidate stride:
+    //  - along each candidate lattice edge, the surface crossing found at the candidate
+    //    stride must be within tolerance of the one found at half of it
+    //  - at the centers of candidate faces & cells, the inside/outside classification
+    //    predicted by the surrounding candidate lattice points must be correct
+    // Candidates are the base stride times a power of two which divides the node's size,
+    // since TransitionFaces stitches neighbors whose strides differ by powers of two, and
+    // a node's lattice must be aligned to its neighbors'.
+    int maxStride = baseStride;
+    while (maxStride * 2 <= _adaptiveMaxStride && size % (maxStride * 2) == 0) {
+        maxStride *= 2;
+    }
+
+    std::vector<float> values;
+    for (int stride = maxStride; stride > baseStride; stride /= 2) {
+        const int half = stride / 2;
+        const int n = (size + half - 1) / half + 1;
+        values.resize(static_cast<std::size_t>(n * n * n));
+        for (int k = 0, i = 0; k < n; k++) {
+            for (int j = 0; j < n; j++) {
+                for (int h = 0; h < n; h++, i++) {
+                    MaterialState _;
+                    const auto p = glm::min(region.min + ivec3(h, j, k) * half, region.max);
+                    values[i] = valueSampler(vec3(p), _);
+                }
+            }
+        }
+        _marchStats.samplerEvaluations += values.size() * numSamplers;
+
+        const auto at = [&values, n](int h, int j, int k) {
+            return values[(k * n + j) * n + h];
+        };
+
+        // position of the surface crossing along an edge from a to b, in units of the edge's length
+        const auto crossing = [](float a, float b) {
+            return (IsoLevel - a) / (b - a);
+        };
+
+        bool acceptable = true;
+        for (int k = 0; k < n && acceptable; k++) {
+            for (int j = 0; j < n && acceptable; j++) {
+                for (int h = 0; h < n && acceptable; h++) {
+                    const int oh = h % 2, oj = j % 2, ok = k % 2;
+                    const int odd = oh + oj + ok;
+                    if (odd == 0 || h + oh >= n || j + oj >= n || k + ok >= n) {
+                        continue;
+                    }
+
+                    const float mid = at(h, j, k);
+                    if (odd == 1) {
+                        // midpoint of a candidate lattice edge
+                        const float a = at(h - oh, j - oj, k - ok);
+                        const float b = at(h + oh, j + oj, k + ok);
+                        const bool coarseCrosses = (a < IsoLevel) != (b < IsoLevel);
+                        const int fineCrossings = ((a < IsoLevel) != (mid < IsoLevel)) + ((mid < IsoLevel) != (b < IsoLevel));
+                        if (coarseCrosses != (fineCrossings == 1)) {
+                            acceptable = false;
+                        } else if (coarseCrosses) {
+                            const float coarse = crossing(a, b) * stride;
+                            const float fine = (a < IsoLevel) != (mid < IsoLevel)
+                                ? crossing(a, mid) * half
+                                : half + crossing(mid, b) * half;
+                            acceptable = std::abs(coarse - fine) <= _adaptiveTolerance;
+                        }
+                    } else {
+                        // center of a candidate lattice face or cell
+                        float sum = 0;
+                        int count = 0;
+                        for (int dk = -ok; dk <= ok; dk += 2) {
+                            for (int dj = -oj; dj <= oj; dj += 2) {
+                                for (int dh = -oh; dh <= oh; dh += 2) {
+                                    sum += at(h + dh, j + dj, k + dk);
+                                    count++;
+                                }
+                            }
+                        }
+                        acceptable = (sum / count < IsoLevel) == (mid < IsoLevel);
                     }
-                    node = _nodesToMarch.back();
-                    _nodesToMarch.pop_back();
                 }
+            }
+        }
+
+        if (acceptable) {
+            return stride;
+        }
+    }
+
+    return baseStride;
+}
+
+OctreeVolume::Node* OctreeVolume::findMarchedNode(const glm::vec3& p) const
+{
+    Node* node = _root.get();
+    if (!node->bounds.contains(p)) {
+        return nullptr;
+    }
+
+    while (node && !node->empty) {
+        if (node->march) {
+            return node;
+        }
+        if (node->isLeaf) {
+            return nullptr;
+        }
+        node = findChildContaining(node, p);
+    }
+
+    return nullptr;
+}
+
+void OctreeVolume::updateNodeGeometryCaches()
+{
+    // a change of fuzziness or extractor affects every node; changes of march options are per-node
+    if (_fuzziness != _geometryFuzziness || _extractor != _geometryExtractor) {
+        for (auto node : _occupiedNodes) {
+            node->_geometry.reset();
+        }
+        _geometryFuzziness = _fuzziness;
+        _geometryExtractor = _extractor;
+    }
+
+    // release the geometry of nodes which no longer contribute to the volume,
+    // e.g., they're now empty, or were coalesced into their parent
+    const std::unordered_set<Node*> collected(_nodesToMarch.begin(), _nodesToMarch.end());
+    for (auto node : _occupiedNodes) {
+        if (!collected.count(node)) {
+            node->_geometry.reset();
+        }
+    }
+    _occupiedNodes = _nodesToMarch;
 
-                marchNode(node, *_triangleConsumers[threadIdx % N]);
+    // only march the nodes whose cached geometry is stale
+    _nodesToMarch.clear();
+    for (auto node : _occupiedNodes) {
+        if (needsMarch(node)) {
+            if (!node->_geometry) {
+                node->_geometry = std::make_unique<TriangleConsumer<Vertex>>();
             }
+            node->_geometry->start();
+            node->_geometryAdditiveSamplers = node->additiveSamplers;
+            node->_geometrySubtractiveSamplers = node->subtractiveSamplers;
+            node->_geometryMarchOptions = node->_marchOptions;
+            _nodesToMarch.push_back(node);
+        }
+    }
+
+    _dirtySamplers.clear();
+    _marchStats.nodesReused = _occupiedNodes.size() - _nodesToMarch.size();
+}
+
+void OctreeVolume::gatherNodeGeometry()
+{
+    if (_sharedTriangles) {
+        for (auto node : _occupiedNodes) {
+            _sharedTriangles->add(*node->_geometry);
+        }
+        return;
+    }
+
+    // distribute node geometry across the triangle consumers
+    for (std::size_t i = 0, N = _occupiedNodes.size(); i < N; i++) {
+        _triangleConsumers[i % _triangleConsumers.size()]->addTriangles(*_occupiedNodes[i]->_geometry);
+    }
+}
+
+std::vector<std::future<void>> OctreeVolume::marchCollectedNodes()
+{
+    distributeMarchTasks();
+
+    std::vector<std::future<void>> jobs;
+    for (std::size_t i = 0, N = _marchTaskQueues.size(); i < N; i++) {
+        jobs.push_back(_threadPool->enqueue([this, i](int threadIdx) {
+            runMarchTasks(i, threadIdx);
         }));
     }
     return jobs;
 }
 
-void OctreeVolume::marchNode(OctreeVolume::Node* node, TriangleConsumer<Vertex>& tc)
+void OctreeVolume::marchCollectedNodes(std::function<void()> onComplete)
 {
-    const auto fuzziness = this->_fuzziness;
-    const auto valueSampler = [fuzziness, node](const vec3& p, mc::MaterialState& material) {
-        // run additive samplers, interpolating
-        // material state
-        float value = 0;
-        for (auto additiveSampler : node->_additiveSamplersVec) {
-            MaterialState m;
-            auto v = additiveSampler->valueAt(p, fuzziness, m);
-            if (value == 0) {
-                material = m;
-            } else {
-                material = mix(material, m, v);
+    distributeMarchTasks();
+
+    const std::size_t numJobs = _marchTaskQueues.size();
+    _pendingMarchJobs = numJobs;
+    for (std::size_t i = 0; i < numJobs; i++) {
+        _threadPool->enqueue([this, i, onComplete](int threadIdx) {
+            runMarchTasks(i, threadIdx);
+            if (--_pendingMarchJobs == 0) {
+                onComplete();
+            }
+        });
+    }
+}
+
+void OctreeVolume::runMarchTasks(std::size_t queueIdx, int threadIdx)
+{
+    MarchTask task;
+    while (takeMarchTask(queueIdx, task)) {
+        if (_incrementalMarching) {
+            marchNode(task.node, task.region, *task.node->_geometry);
+        } else if (_sharedTriangles) {
+            marchNode(task.node, task.region, _sharedTriangles->writer(threadIdx));
+        } else {
+            marchNode(task.node, task.region, *_triangleConsumers[threadIdx % _triangleConsumers.size()]);
+        }
+    }
+}
+
+void OctreeVolume::distributeMarchTasks()
+{
+    const std::size_t numQueues = _threadPool->size();
+    while (_marchTaskQueues.size() < numQueues) {
+        _marchTaskQueues.push_back(std::make_unique<MarchTaskQueue>());
+    }
+
+    // estimate the cost of marching each node as the number of sampler evaluations
+    std::vector<MarchTask> tasks;
+    std::size_t totalCost = 0;
+    for (auto node : _nodesToMarch) {
+        const auto region = util::iAABB(node->bounds);
+        const auto cells = detail::Lattice(region, node->_marchOptions.stride).cells();
+        const auto numSamplers = node->_additiveSamplersVec.size() + node->_subtractiveSamplersVec.size();
+        const auto cost = static_cast<std::size_t>(cells.x * cells.y * cells.z) * std::max<std::size_t>(numSamplers, 1);
+        tasks.push_back(MarchTask { node, region, cost });
+        totalCost += cost;
+    }
+    _nodesToMarch.clear();
+
+    // Split nodes costing more than a fraction of each worker's share into ranges
+    // of z slices, so a single large coalesced node doesn't leave the other workers
+    // idle. Incrementally marched nodes own a single TriangleConsumer which can't be
+    // written to concurrently, so they're marched whole. Pieces are whole multiples
+    // of the stride, so they sample the same lattice as the unsplit node. Nodes are
+    // also marched whole with smooth normals, whose gradients at a region's faces are
+    // sampled rather than read from the lattice, so the mesh doesn't depend on how
+    // many workers there are.
+    if (!_incrementalMarching && !_marchOptions.smoothNormals && numQueues > 1) {
+        const std::size_t maxCost = std::max<std::size_t>(totalCost / (numQueues * 4), 1);
+        for (std::size_t i = 0, N = tasks.size(); i < N; i++) {
+            const auto task = tasks[i];
+            const int stride = std::max(task.node->_marchOptions.stride, 1);
+            const int depth = task.region.size().z;
+            const int layers = (depth + stride - 1) / stride;
+            const int pieces = static_cast<int>(std::min<std::size_t>((task.cost + maxCost - 1) / maxCost, layers));
+            if (pieces < 2) {
+                continue;
+            }
+
+            const int slices = ((layers + pieces - 1) / pieces) * stride;
+            for (int z = task.region.min.z; z < task.region.max.z; z += slices) {
+                MarchTask piece = task;
+                piece.region.min.z = z;
+                piece.region.max.z = std::min(z + slices, task.region.max.z);
+                piece.cost = task.cost * (piece.region.max.z - piece.region.min.z) / depth;
+                if (z == task.region.min.z) {
+                    tasks[i] = piece;
+                } else {
+                    tasks.push_back(piece);
+                }
             }
-            value += v;
         }
+    }
+
+    // deal the tasks out most expensive first, so each queue is in descending cost order
+    std::sort(tasks.begin(), tasks.end(), [](const MarchTask& a, const MarchTask& b) {
+        return a.cost > b.cost;
+    });
 
-        // run subtractions (these don't affect material state)
-        value = min<float>(value, 1.0F);
-        for (auto subtractiveSampler : node->_subtractiveSamplersVec) {
-            MaterialState _;
-            value -= subtractiveSampler->valueAt(p, fuzziness, _);
+    for (std::size_t i = 0, N = tasks.size(); i < N; i++) {
+        _marchTaskQueues[i % numQueues]->tasks.push_back(tasks[i]);
+    }
+}
+
+bool OctreeVolume::takeMarchTask(std::size_t queueIdx, MarchTask& task)
+{
+    // take the most expensive task from our own queue
+    {
+        auto& queue = *_marchTaskQueues[queueIdx];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+            return true;
         }
-        value = max<float>(value, 0.0F);
+    }
 
-        return value;
-    };
-    mc::march(util::iAABB(node->bounds), valueSampler, tc);
+    // steal the cheapest task from another queue
+    for (std::size_t i = 1, N = _marchTaskQueues.size(); i < N; i++) {
+        auto& queue = *_marchTaskQueues[(queueIdx + i) % N];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // all tasks are distributed up front, so once every queue is empty we're done
+    return false;
+}
+
+template <class Consumer>
+void OctreeVolume::marchNode(OctreeVolume::Node* node, util::iAABB region, Consumer& tc)
+{
+    const CompositeSampler valueSampler(node->_additiveSamplersVec, node->_subtractiveSamplersVec, _fuzziness);
+
+    // a range of the node's z slices borders the rest of the node, not its neighbors,
+    // on the z faces and the x & y edges lying on them
+    auto options = node->_marchOptions;
+    const auto bounds = util::iAABB(node->bounds);
+    for (int side = 0; side < 2; side++) {
+        if (side ? region.max.z != bounds.max.z : region.min.z != bounds.min.z) {
+            options.neighborStrides[4 + side] = 0;
+            for (int e = 0; e < 8; e++) {
+                if ((e & 1) == side) {
+                    options.edgeNeighborStrides[e] = 0;
+                }
+            }
+        }
+    }
+
+    if (_extractor == Extractor::SurfaceNets) {
+        mc::surfaceNets(region, valueSampler, tc, options);
+    } else {
+        mc::march(region, valueSampler, tc, options);
+    }
+}
+
+util::AABB OctreeVolume::samplingBounds(const Node* node) const
+{
+    if (_extractor != Extractor::SurfaceNets) {
+        return node->bounds;
+    }
+
+    // surface nets reads the cells a stride past the node's min faces
+    auto bounds = node->bounds;
+    bounds.min -= vec3(std::max(_marchOptions.stride, 1));
+    return bounds;
 }
 
 } // namespace mc
\ No newline at end of file
@@ -9,7 +9,10 @@
 #ifndef volume_hpp
 #define volume_hpp
 
+#include <algorithm>
 #include <array>
+#include <deque>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <unordered_set>
@@ -17,10 +20,18 @@
 
 #include "marching_cubes.hpp"
 #include "triangle_consumer.hpp"
-#include "util/util.hpp"
+#include "util/core.hpp"
 
 namespace mc {
 
+/**
+ * A closed interval [min, max] of volume values; see IVolumeSampler::rangeOver
+ */
+struct ValueRange {
+    float min = -std::numeric_limits<float>::infinity();
+    float max = std::numeric_limits<float>::infinity();
+};
+
 /**
  * IVolumeSampler represents a "thing" which can be queried for isosurface contribution to
  * a BaseCompositeVolume. Subclasses (e.g., SphereVolumeSampler) will use a parametric or
@@ -82,6 +93,46 @@ public:
      */
     virtual float valueAt(const glm::vec3& p, float fuzziness, MaterialState& material) const = 0;
 
+    /*
+     Batched variant of valueAt(). Evaluates n points whose coordinates are passed
+     as separate x, y and z arrays, writing each point's value into values[i] and
+     updating materials[i] exactly as valueAt() would. materials may be null, when
+     the caller needs only values; implementations should then skip material work.
+     The default implementation calls valueAt() per point; samplers can override
+     this with a SIMD implementation.
+     */
+    virtual void valuesAt(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float fuzziness, float* values, MaterialState* materials) const
+    {
+        MaterialState unused;
+        for (std::size_t i = 0; i < n; i++) {
+            values[i] = valueAt(glm::vec3(xs[i], ys[i], zs[i]), fuzziness, materials ? materials[i] : unused);
+        }
+    }
+
+    /*
+     Return a lower bound on the distance from p to the nearest point where valueAt()
+     would return a different value or material than it does at p; e.g., for a sphere,
+     the distance from p to the shell between radius - fuzziness and radius. Marching
+     fills the lattice points within the bound of every sampler from a single sample.
+     The default returns 0, offering no bound.
+     */
+    virtual float distanceBound(const glm::vec3& p, float fuzziness) const
+    {
+        return 0;
+    }
+
+    /*
+     Return an interval containing every value valueAt() returns for points in bounds.
+     OctreeVolume combines these across a node's samplers, and doesn't march nodes
+     whose combined interval lies wholly inside or outside the isosurface.
+     The default returns an unbounded interval, excluding nothing.
+     */
+    virtual ValueRange rangeOver(util::AABB bounds, float fuzziness) const
+    {
+        return ValueRange {};
+    }
+
 private:
     Mode _mode;
 };
@@ -116,9 +167,35 @@ public:
             break;
         }
 
+        onSamplerAdded(sPtr);
         return sPtr;
     }
 
+    // Removes an IVolumeSampler previously added to this volume, destroying it.
+    void remove(util::unowned_ptr<IVolumeSampler> sampler)
+    {
+        auto pos = std::find_if(_samplers.begin(), _samplers.end(), [&sampler](const std::unique_ptr<IVolumeSampler>& s) {
+            return s.get() == sampler.get();
+        });
+        if (pos == _samplers.end()) {
+            return;
+        }
+
+        onSamplerRemoved(sampler.get());
+
+        auto& samplers = sampler->getMode() == IVolumeSampler::Mode::Additive ? _additiveSamplers : _subtractiveSamplers;
+        samplers.erase(std::find(samplers.begin(), samplers.end(), sampler.get()));
+        _samplers.erase(pos);
+    }
+
+    /*
+     Notify the volume that a sampler's shape, position or material was modified in place.
+     oldBounds must enclose the region the sampler affected before the modification.
+     */
+    virtual void notifyChanged(util::unowned_ptr<IVolumeSampler> sampler, const util::AABB& oldBounds)
+    {
+    }
+
     // Clear storage of IVolumeSamplers.
     virtual void clear()
     {
@@ -141,6 +218,15 @@ public:
     float getFuzziness() const { return _fuzziness; }
 
 protected:
+    // Called after a sampler is added, and before a sampler is removed & destroyed.
+    virtual void onSamplerAdded(IVolumeSampler* sampler)
+    {
+    }
+
+    virtual void onSamplerRemoved(IVolumeSampler* sampler)
+    {
+    }
+
     glm::ivec3 _size;
     float _fuzziness;
     std::vector<IVolumeSampler*> _additiveSamplers, _subtractiveSamplers;
@@ -205,12 +291,38 @@ public:
             return value;
         }
 
+        /**
+         * Bound the values valueAt() returns for points in bounds, combining each
+         * sampler's IVolumeSampler::rangeOver() as valueAt() combines their values.
+         */
+        ValueRange rangeOver(const util::AABB& bounds, float fuzziness) const
+        {
+            ValueRange range { 0, 0 };
+            for (auto additiveSampler : additiveSamplers) {
+                const auto r = additiveSampler->rangeOver(bounds, fuzziness);
+                range.min += r.min;
+                range.max += r.max;
+            }
+
+            range.min = std::min<float>(range.min, 1.0F);
+            range.max = std::min<float>(range.max, 1.0F);
+            for (auto subtractiveSampler : subtractiveSamplers) {
+                const auto r = subtractiveSampler->rangeOver(bounds, fuzziness);
+                range.min -= r.max;
+                range.max -= r.min;
+            }
+            range.min = std::max<float>(range.min, 0.0F);
+            range.max = std::max<float>(range.max, 0.0F);
+
+            return range;
+        }
+
         util::AABB bounds;
         int depth = 0;
         int childIdx = 0;
         bool isLeaf = false;
         bool march = false;
-        bool empty = false;
+        bool empty = true;
         std::array<std::unique_ptr<Node>, 8> children;
         std::unordered_set<IVolumeSampler*> additiveSamplers;
         std::unordered_set<IVolumeSampler*> subtractiveSamplers;
@@ -219,9 +331,55 @@ public:
         friend class OctreeVolume;
         std::vector<IVolumeSampler*> _additiveSamplersVec;
         std::vector<IVolumeSampler*> _subtractiveSamplersVec;
+
+        // when incremental marching, the geometry from this node's last march,
+        // and the samplers it was marched with
+        std::unique_ptr<TriangleConsumer<Vertex>> _geometry;
+        std::unordered_set<IVolumeSampler*> _geometryAdditiveSamplers;
+        std::unordered_set<IVolumeSampler*> _geometrySubtractiveSamplers;
+
+        // when incremental marching, true if a sampler change may affect this node's
+        // mark() result, and the result of this node's last mark()
+        bool _dirty = true;
+        bool _marked = false;
+
+        // the options this node is marched with, and those its cached geometry was
+        // marched with; when adaptive marching, the stride the node's field detail
+        // allows, and the volume stride that was estimated against
+        MarchOptions _marchOptions;
+        MarchOptions _geometryMarchOptions;
+        int _detailStride = 0;
+        int _detailBaseStride = 0;
+    };
+
+    /**
+     * Timings and workload of the most recent march() or marchAsync() pass
+     */
+    struct MarchStats {
+        // seconds spent marking the nodes which intersect samplers
+        double markSeconds = 0;
+        // seconds spent collecting marked nodes into the list to march
+        double collectSeconds = 0;
+        // seconds spent marching the collected nodes
+        double marchSeconds = 0;
+        // number of nodes marched
+        std::size_t nodesMarched = 0;
+        // number of nodes whose cached geometry was reused (see setIncrementalMarching)
+        std::size_t nodesReused = 0;
+        // number of cells covered by the marched nodes
+        std::size_t voxels = 0;
+        // number of IVolumeSampler evaluations; each marched node samples
+        // its lattice points (see setMarchOptions) once per sampler intersecting it.
+        // Points filled from a sampler's distanceBound() are counted too.
+        std::size_t samplerEvaluations = 0;
     };
 
 public:
+    /**
+     * Create an OctreeVolume of size^3 cells, whose leaf nodes are minNodeSize^3 cells.
+     * threadPool may be shared with other volumes; nodes are marched into the
+     * triangleConsumers, one of which is required per thread in threadPool.
+     */
     OctreeVolume(int size, float fuzziness, int minNodeSize,
         const mc::util::unowned_ptr<util::ThreadPool> threadPool,
         const std::vector<util::unowned_ptr<TriangleConsumer<Vertex>>>& triangleConsumers)
@@ -233,12 +391,94 @@ public:
     {
     }
 
+    /**
+     * Create an OctreeVolume as above, whose threads all march into the single
+     * triangleConsumer, so each march produces one contiguous mesh. Threads write
+     * their triangles straight into blocks of triangleConsumer's storage, which they
+     * reserve through a SharedTriangleSink. Since a pass writes into storage the next
+     * pass resizes, marchAsync() must not be called while isMarching().
+     */
+    OctreeVolume(int size, float fuzziness, int minNodeSize,
+        const mc::util::unowned_ptr<util::ThreadPool> threadPool,
+        util::unowned_ptr<TriangleConsumer<Vertex>> triangleConsumer)
+        : OctreeVolume(size, fuzziness, minNodeSize, threadPool,
+            std::vector<util::unowned_ptr<TriangleConsumer<Vertex>>> { triangleConsumer })
+    {
+        _sharedTriangles = std::make_unique<SharedTriangleSink<Vertex>>();
+    }
+
     void clear() override
     {
         BaseCompositeVolume::clear();
         clear(_root.get());
+
+        for (auto node : _occupiedNodes) {
+            node->_geometry.reset();
+        }
+        _occupiedNodes.clear();
+        _dirtySamplers.clear();
     }
 
+    /**
+     * When enabled, each marched node keeps a copy of its geometry, and march() and
+     * marchAsync() only re-march nodes whose set of intersecting samplers changed, or
+     * which intersect a sampler passed to notifyChanged() since the previous march. The
+     * cached geometry of the remaining nodes is copied into the triangle consumers as-is.
+     * Likewise, the mark pass only revisits nodes touched by samplers added, removed or
+     * passed to notifyChanged() since the previous march.
+     * Disabled by default, since it doubles the memory used for geometry.
+     * NOTE: When enabled, samplers modified in place MUST be passed to notifyChanged(),
+     * and a marchedNodeObserver receives every node contributing geometry, whether
+     * re-marched or reused.
+     */
+    void setIncrementalMarching(bool incremental);
+    bool isIncrementalMarching() const { return _incrementalMarching; }
+
+    /**
+     * Set the options, e.g. the lattice stride, used by subsequent calls to march() and
+     * marchAsync(). A stride of N marches each node with cells N voxels on a side, for a
+     * coarser level of detail which costs roughly N^3 fewer sampler evaluations.
+     * The options' neighborStrides describe the regions adjoining this volume's bounds,
+     * e.g., neighboring terrain chunks; the faces of nodes on those bounds are stitched
+     * to coarser neighbors.
+     */
+    void setMarchOptions(const MarchOptions& options);
+    const MarchOptions& getMarchOptions() const { return _marchOptions; }
+
+    /**
+     * Set the algorithm used to extract the isosurface of each node; MarchingCubes by
+     * default. SurfaceNets shares vertices and produces none of marching cubes' slivers,
+     * but doesn't stitch to coarser neighbors, so while it's selected adaptive marching is
+     * suspended, and the volume's neighborStrides are ignored. Surface nets reads a margin
+     * of cells past each node's min faces, so each node is marched with the samplers
+     * intersecting that margin too.
+     */
+    void setExtractor(Extractor extractor);
+    Extractor getExtractor() const { return _extractor; }
+
+    /**
+     * When enabled, each marched node is probed to find the coarsest stride, up to maxStride,
+     * among the volume's stride times the powers of two dividing the node's size, which
+     * places its surface to within tolerance voxels of where half that stride would, and
+     * misses no surface detail the finer lattice sees. Flat or smooth regions are then
+     * marched with larger cells, and only nodes with fine surface detail are marched at the
+     * volume's stride (see setMarchOptions). Faces and edges between nodes of differing stride
+     * are stitched (see MarchOptions::neighborStrides); to that end a node is never coarser
+     * than a larger neighbor, and nodes on the volume's bounds facing a neighbor keep the
+     * volume's stride. Tolerances beyond a voxel or so may open small cracks where several
+     * strides meet. Disabled by default.
+     */
+    void setAdaptiveMarching(bool adaptive, int maxStride = 8, float tolerance = 0.5F);
+    bool isAdaptiveMarching() const { return _adaptiveMarching; }
+
+    /**
+     * Notify the volume that a sampler's shape, position or material has changed, so the
+     * nodes intersecting oldBounds or the sampler's current extent will be re-marked and
+     * re-marched by the next incremental march. Samplers which were added since the last
+     * march need not be passed here.
+     */
+    void notifyChanged(util::unowned_ptr<IVolumeSampler> sampler, const util::AABB& oldBounds) override;
+
     // Gathers all nodes which contain IVolumeSampler instances.
     void collect(std::vector<Node*>& collector)
     {
@@ -282,7 +522,7 @@ public:
      * main thread when the work is done
      * NOTE:
      * onReady & marchedNodeObserver will be called on the main thread, which requires use of
-     *  mc::util::MainThreadQueue::drain()
+     *  mc::util::MainThreadQueue::drain(). marchedNodeObserver is called for each node before onReady.
      */
     void marchAsync(
         std::function<void()> onReady,
@@ -309,33 +549,85 @@ public:
      */
     bool isMarching() const { return _marching; }
 
+    /**
+     * Returns timings and workload of the most recently completed march pass
+     */
+    const MarchStats& getLastMarchStats() const { return _lastMarchStats; }
+
 protected:
+    void startTriangleConsumers();
     void marchSetup();
+    // A node, or a range of a node's z slices, to march
+    struct MarchTask {
+        Node* node = nullptr;
+        util::iAABB region;
+        std::size_t cost = 0;
+    };
+
+    // Per-worker queue of MarchTasks. A worker takes tasks from the front of its
+    // own queue, and when it runs dry steals from the back of the others.
+    struct MarchTaskQueue {
+        std::mutex mutex;
+        std::deque<MarchTask> tasks;
+    };
+
     std::vector<std::future<void>> marchCollectedNodes();
-    void marchNode(OctreeVolume::Node* node, TriangleConsumer<Vertex>& tc);
+    void marchCollectedNodes(std::function<void()> onComplete);
+    void runMarchTasks(std::size_t queueIdx, int threadIdx);
+    void distributeMarchTasks();
+    bool takeMarchTask(std::size_t queueIdx, MarchTask& task);
+    // Consumer is a TriangleConsumer<Vertex> or SharedTriangleSink<Vertex>::Writer
+    template <class Consumer>
+    void marchNode(OctreeVolume::Node* node, util::iAABB region, Consumer& tc);
+    bool samplersChanged(const Node* node) const;
+    bool needsMarch(const Node* node) const;
+    void assignNodeMarchOptions();
+    int estimateStride(Node* node);
+    Node* findMarchedNode(const glm::vec3& p) const;
+    util::AABB samplingBounds(const Node* node) const;
+    void updateNodeGeometryCaches();
+    void gatherNodeGeometry();
+    void onSamplerAdded(IVolumeSampler* sampler) override;
+    void onSamplerRemoved(IVolumeSampler* sampler) override;
 
     void clear(Node* currentNode)
     {
         currentNode->empty = true;
         currentNode->march = false;
+        currentNode->_dirty = true;
 
         currentNode->additiveSamplers.clear();
         currentNode->subtractiveSamplers.clear();
         currentNode->_additiveSamplersVec.clear();
         currentNode->_subtractiveSamplersVec.clear();
 
-        for (const auto& node : currentNode->children) {
-            if (!node->isLeaf) {
+        if (!currentNode->isLeaf) {
+            for (const auto& node : currentNode->children) {
                 clear(node.get());
             }
         }
     }
 
     /**
-     * Mark the nodes which should be marched.
+     * Mark the nodes which should be marched. When incremental marching, nodes
+     * unaffected by sampler changes since they were last marked keep their previous result.
     */
     bool mark(Node* currentNode) const
     {
+        if (_incrementalMarching && !currentNode->_dirty) {
+            // restore the march flag, since a parent may have coalesced this node
+            currentNode->march = currentNode->_marked;
+            return currentNode->_marked;
+        }
+
+        currentNode->_dirty = false;
+        currentNode->_marked = markNode(currentNode);
+        return currentNode->_marked;
+    }
+
+    bool markNode(Node* currentNode) const
+    {
+        const bool wasEmpty = currentNode->empty;
         currentNode->empty = true;
         currentNode->march = false;
 
@@ -343,7 +635,7 @@ protected:
         currentNode->subtractiveSamplers.clear();
 
         for (const auto sampler : _additiveSamplers) {
-            if (sampler->intersects(currentNode->bounds)) {
+            if (sampler->intersects(samplingBounds(currentNode))) {
                 currentNode->additiveSamplers.insert(sampler);
                 currentNode->empty = false;
             }
@@ -354,7 +646,7 @@ protected:
         // additive samplers, there is no volume to subtract from
         if (!currentNode->empty) {
             for (const auto sampler : _subtractiveSamplers) {
-                auto intersection = sampler->intersection(currentNode->bounds);
+                auto intersection = sampler->intersection(samplingBounds(currentNode));
                 switch (intersection) {
                 case IVolumeSampler::AABBIntersection::IntersectsAABB:
                     currentNode->subtractiveSamplers.insert(sampler);
@@ -381,8 +673,14 @@ protected:
         if (!currentNode->empty) {
 
             if (currentNode->isLeaf) {
-                currentNode->march = true;
-                return true;
+                // a leaf whose field lies wholly inside or outside the isosurface has nothing
+                // to march; it keeps its samplers, since Node::valueAt still answers for it.
+                // The margin absorbs float error between rangeOver() and the sampled values.
+                constexpr float IsoLevel = 0.5F;
+                constexpr float RangeMargin = 1e-3F;
+                const auto range = currentNode->rangeOver(samplingBounds(currentNode), _fuzziness);
+                currentNode->march = range.min < IsoLevel + RangeMargin && range.max >= IsoLevel - RangeMargin;
+                return currentNode->march;
             }
 
             // some samplers intersect this node; traverse down
@@ -410,9 +708,41 @@ protected:
             }
         }
 
+        if (currentNode->empty && !wasEmpty && !currentNode->isLeaf) {
+            // collect() and mark() won't descend into this node, so drop its
+            // children's samplers rather than leave them stale
+            for (auto& child : currentNode->children) {
+                release(child.get());
+            }
+        }
+
         return false;
     }
 
+    /**
+     * Clears the samplers of currentNode and its descendants, stopping at nodes
+     * which are already empty, since their descendants were released when they emptied.
+    */
+    void release(Node* currentNode) const
+    {
+        if (currentNode->empty) {
+            return;
+        }
+
+        currentNode->empty = true;
+        currentNode->march = false;
+        currentNode->_dirty = true;
+
+        currentNode->additiveSamplers.clear();
+        currentNode->subtractiveSamplers.clear();
+
+        if (!currentNode->isLeaf) {
+            for (auto& child : currentNode->children) {
+                release(child.get());
+            }
+        }
+    }
+
     /**
      * After calling mark(), this will collect all nodes which should be marched
     */
@@ -459,10 +789,29 @@ private:
     std::vector<Node*> _nodesToMarch, _marchedNodes;
     mc::util::unowned_ptr<util::ThreadPool> _threadPool;
     std::vector<util::unowned_ptr<TriangleConsumer<Vertex>>> _triangleConsumers;
+    // when marching into a single shared consumer, the sink the threads write to it through
+    std::unique_ptr<SharedTriangleSink<Vertex>> _sharedTriangles;
     std::size_t _asyncMarchId { 0 };
-    std::mutex _queuePopMutex;
+    std::vector<std::unique_ptr<MarchTaskQueue>> _marchTaskQueues;
+
+    // stats accumulate in _marchStats while a pass runs, and are published
+    // to _lastMarchStats when it completes
+    MarchStats _marchStats, _lastMarchStats;
+
+    MarchOptions _marchOptions;
+    Extractor _extractor = Extractor::MarchingCubes;
+
+    bool _adaptiveMarching = false;
+    int _adaptiveMaxStride = 8;
+    float _adaptiveTolerance = 0.5F;
+
+    bool _incrementalMarching = false;
+    float _geometryFuzziness = 0;
+    Extractor _geometryExtractor = Extractor::MarchingCubes;
+    std::vector<Node*> _occupiedNodes;
+    std::unordered_set<IVolumeSampler*> _dirtySamplers;
 
-    std::future<void> _asyncWaiter;
+    std::atomic<std::size_t> _pendingMarchJobs { 0 };
     std::atomic_bool _marching;
 };
 
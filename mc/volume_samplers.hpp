@@ -9,7 +9,8 @@
 #ifndef volume_samplers_h
 #define volume_samplers_h
 
-#include "util/util.hpp"
+#include "util/simd.hpp"
+#include "util/core.hpp"
 #include "volume.hpp"
 
 namespace mc {
@@ -117,6 +118,64 @@ namespace volume_samplers_helpers {
         return boundedPlaneIntersection(origin, normal, halfExtent, bounds.corners());
     }
 
+    /*
+    Blend material into the materials of a batch of points after a SIMD pass, following
+    the convention of the scalar valueAt() implementations: points flagged in fullMask
+    receive material outright, other points with a non-zero value mix towards it.
+    A null materials (see IVolumeSampler::valuesAt) is left alone.
+    */
+    inline void blendMaterials(const float* values, int fullMask, int width,
+        const MaterialState& material, MaterialState* materials)
+    {
+        if (!materials) {
+            return;
+        }
+
+        for (int i = 0; i < width; i++) {
+            if (fullMask & (1 << i)) {
+                materials[i] = material;
+            } else if (values[i] > 0) {
+                materials[i] = mix(materials[i], material, values[i]);
+            }
+        }
+    }
+
+    /*
+    Range of the signed distance dot(normal, v - origin) over the points v in bounds
+    */
+    inline glm::vec2 projectedRange(const util::AABB& bounds, glm::vec3 origin, glm::vec3 normal)
+    {
+        const float center = dot(normal, bounds.center() - origin);
+        const float extent = dot(glm::abs(normal), bounds.size() * 0.5F);
+        return glm::vec2(center - extent, center + extent);
+    }
+
+    /*
+    Range of the absolute value of the values in range
+    */
+    inline glm::vec2 absRange(glm::vec2 range)
+    {
+        const float far = glm::max(glm::abs(range.x), glm::abs(range.y));
+        if (range.x <= 0 && range.y >= 0) {
+            return glm::vec2(0, far);
+        }
+        return glm::vec2(glm::min(glm::abs(range.x), glm::abs(range.y)), far);
+    }
+
+    /*
+    The value of a shell which is 1 at distances up to innerDist, 0 from outerDist,
+    and falls linearly between
+    */
+    inline float shellValue(float dist, float innerDist, float outerDist)
+    {
+        if (dist <= innerDist) {
+            return 1;
+        } else if (dist >= outerDist) {
+            return 0;
+        }
+        return 1 - (dist - innerDist) / (outerDist - innerDist);
+    }
+
 } // namespace volume_samplers_detail
 
 /*
@@ -162,21 +221,18 @@ public:
 
     AABBIntersection intersection(util::AABB bounds) const override
     {
-        int inside = 0;
+        // the sphere can cut into a face of bounds without containing any of its corners
+        if (!intersects(bounds)) {
+            return IVolumeSampler::AABBIntersection::None;
+        }
+
         for (auto& v : bounds.corners()) {
-            if (distance2(v, _position) < _radius2) {
-                inside++;
+            if (distance2(v, _position) >= _radius2) {
+                return IVolumeSampler::AABBIntersection::IntersectsAABB;
             }
         }
 
-        switch (inside) {
-        case 0:
-            return IVolumeSampler::AABBIntersection::None;
-        case 8:
-            return IVolumeSampler::AABBIntersection::ContainsAABB;
-        default:
-            return IVolumeSampler::AABBIntersection::IntersectsAABB;
-        }
+        return IVolumeSampler::AABBIntersection::ContainsAABB;
     }
 
     float valueAt(const glm::vec3& p, float fuzziness, MaterialState& material) const override
@@ -200,6 +256,67 @@ public:
         return c;
     }
 
+    void valuesAt(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float fuzziness, float* values, MaterialState* materials) const override
+    {
+        using util::simd::floatv;
+        const float innerRadius = _radius - fuzziness;
+        const floatv min2 = innerRadius * innerRadius;
+        const floatv max2 = _radius * _radius;
+        const floatv px = _position.x, py = _position.y, pz = _position.z;
+
+        std::size_t i = 0;
+        for (; i + floatv::width <= n; i += floatv::width) {
+            const floatv dx = floatv::load(xs + i) - px;
+            const floatv dy = floatv::load(ys + i) - py;
+            const floatv dz = floatv::load(zs + i) - pz;
+            const floatv d2 = util::simd::dot(dx, dy, dz, dx, dy, dz);
+            const floatv c = 1.0F - ((util::simd::sqrt(d2) - innerRadius) / fuzziness);
+            const floatv inner = d2 <= min2;
+            util::simd::select(inner, 1.0F, util::simd::select(d2 >= max2, 0.0F, c)).store(values + i);
+            volume_samplers_helpers::blendMaterials(values + i, util::simd::movemask(inner), floatv::width, _material, materials ? materials + i : nullptr);
+        }
+
+        MaterialState unused;
+        for (; i < n; i++) {
+            values[i] = valueAt(glm::vec3(xs[i], ys[i], zs[i]), fuzziness, materials ? materials[i] : unused);
+        }
+    }
+
+    float distanceBound(const glm::vec3& p, float fuzziness) const override
+    {
+        // the value is 1 within radius - fuzziness of the center, and 0 beyond radius
+        const float innerRadius = _radius - fuzziness;
+        if (innerRadius < 0) {
+            return 0;
+        }
+
+        const float d = distance(p, _position);
+        if (d >= _radius) {
+            return d - _radius;
+        }
+        return glm::max(innerRadius - d, 0.0F);
+    }
+
+    ValueRange rangeOver(util::AABB bounds, float fuzziness) const override
+    {
+        using volume_samplers_helpers::shellValue;
+
+        // the value falls with distance from the center; when fuzziness exceeds the radius,
+        // valueAt() is 1 near the center, so it isn't monotonic
+        const float innerRadius = _radius - fuzziness;
+        if (innerRadius < 0) {
+            return ValueRange { 0, 1 };
+        }
+
+        const auto nearest = glm::clamp(_position, bounds.min, bounds.max);
+        const auto farthest = glm::max(glm::abs(_position - bounds.min), glm::abs(_position - bounds.max));
+        return ValueRange {
+            shellValue(length(farthest), innerRadius, _radius),
+            shellValue(distance(nearest, _position), innerRadius, _radius)
+        };
+    }
+
     void setPosition(const glm::vec3& center)
     {
         _position = center;
@@ -287,6 +404,50 @@ public:
         return c;
     }
 
+    void valuesAt(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float fuzziness, float* values, MaterialState* materials) const override
+    {
+        using util::simd::floatv;
+        const floatv nx = _normal.x, ny = _normal.y, nz = _normal.z;
+        const floatv ox = _origin.x, oy = _origin.y, oz = _origin.z;
+
+        std::size_t i = 0;
+        for (; i + floatv::width <= n; i += floatv::width) {
+            const floatv signedDist = util::simd::dot(nx, ny, nz,
+                floatv::load(xs + i) - ox, floatv::load(ys + i) - oy, floatv::load(zs + i) - oz);
+            const floatv inner = signedDist < -fuzziness;
+            const floatv c = -signedDist / fuzziness;
+            util::simd::select(inner, 1.0F, util::simd::select(signedDist > 0.0F, 0.0F, c)).store(values + i);
+            volume_samplers_helpers::blendMaterials(values + i, util::simd::movemask(inner), floatv::width, _material, materials ? materials + i : nullptr);
+        }
+
+        MaterialState unused;
+        for (; i < n; i++) {
+            values[i] = valueAt(glm::vec3(xs[i], ys[i], zs[i]), fuzziness, materials ? materials[i] : unused);
+        }
+    }
+
+    float distanceBound(const glm::vec3& p, float fuzziness) const override
+    {
+        // the value is 0 on the positive side of the plane, and 1 beyond fuzziness on its negative side;
+        // the constructor doesn't normalize _normal, so scale signed distances by its length
+        const float signedDist = dot(_normal, p - _origin);
+        if (signedDist > 0) {
+            return signedDist / length(_normal);
+        }
+        return glm::max(-fuzziness - signedDist, 0.0F) / length(_normal);
+    }
+
+    ValueRange rangeOver(util::AABB bounds, float fuzziness) const override
+    {
+        // the value falls with signed distance, from 1 at -fuzziness to 0 at the plane
+        const auto signedDist = volume_samplers_helpers::projectedRange(bounds, _origin, _normal);
+        return ValueRange {
+            volume_samplers_helpers::shellValue(signedDist.y, -fuzziness, 0),
+            volume_samplers_helpers::shellValue(signedDist.x, -fuzziness, 0)
+        };
+    }
+
     void setPlaneOrigin(const glm::vec3 planeOrigin) { _origin = planeOrigin; }
     glm::vec3 planeOrigin() const { return _origin; }
 
@@ -349,6 +510,57 @@ public:
         return c;
     }
 
+    void valuesAt(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float fuzziness, float* values, MaterialState* materials) const override
+    {
+        using util::simd::floatv;
+        const floatv nx = _normal.x, ny = _normal.y, nz = _normal.z;
+        const floatv ox = _origin.x, oy = _origin.y, oz = _origin.z;
+        const float outerDist = _thickness * 0.5F;
+        const float innerDist = outerDist - fuzziness;
+
+        std::size_t i = 0;
+        for (; i + floatv::width <= n; i += floatv::width) {
+            const floatv dist = util::simd::abs(util::simd::dot(nx, ny, nz,
+                floatv::load(xs + i) - ox, floatv::load(ys + i) - oy, floatv::load(zs + i) - oz));
+            const floatv inner = dist <= innerDist;
+            const floatv c = 1.0F - ((dist - innerDist) / fuzziness);
+            util::simd::select(inner, 1.0F, util::simd::select(dist >= outerDist, 0.0F, c)).store(values + i);
+            volume_samplers_helpers::blendMaterials(values + i, util::simd::movemask(inner), floatv::width, _material, materials ? materials + i : nullptr);
+        }
+
+        MaterialState unused;
+        for (; i < n; i++) {
+            values[i] = valueAt(glm::vec3(xs[i], ys[i], zs[i]), fuzziness, materials ? materials[i] : unused);
+        }
+    }
+
+    float distanceBound(const glm::vec3& p, float fuzziness) const override
+    {
+        // the value is 1 within thickness/2 - fuzziness of the plane, and 0 beyond thickness/2
+        const float dist = glm::abs(glm::dot(_normal, p - _origin));
+        const float outerDist = _thickness * 0.5F;
+        const float innerDist = outerDist - fuzziness;
+        if (dist >= outerDist) {
+            return dist - outerDist;
+        }
+        return glm::max(innerDist - dist, 0.0F);
+    }
+
+    ValueRange rangeOver(util::AABB bounds, float fuzziness) const override
+    {
+        using namespace volume_samplers_helpers;
+
+        // the value falls with distance from the plane
+        const auto dist = absRange(projectedRange(bounds, _origin, _normal));
+        const float outerDist = _thickness * 0.5F;
+        const float innerDist = outerDist - fuzziness;
+        return ValueRange {
+            shellValue(dist.y, innerDist, outerDist),
+            shellValue(dist.x, innerDist, outerDist)
+        };
+    }
+
     void setPlaneOrigin(const glm::vec3 planeOrigin) { _origin = planeOrigin; }
     glm::vec3 planeOrigin() const { return _origin; }
 
@@ -479,6 +691,77 @@ public:
         return 0;
     }
 
+    void valuesAt(const float* xs, const float* ys, const float* zs, std::size_t n,
+        float fuzziness, float* values, MaterialState* materials) const override
+    {
+        using util::simd::floatv;
+        using util::simd::min;
+
+        const floatv f = fuzziness + 1e-5F;
+        const floatv ox = _origin.x, oy = _origin.y, oz = _origin.z;
+        const floatv hx = _halfExtents.x, hy = _halfExtents.y, hz = _halfExtents.z;
+
+        std::size_t i = 0;
+        for (; i + floatv::width <= n; i += floatv::width) {
+            const floatv dx = floatv::load(xs + i) - ox;
+            const floatv dy = floatv::load(ys + i) - oy;
+            const floatv dz = floatv::load(zs + i) - oz;
+            const floatv posXDistance = util::simd::dot(_posX.x, _posX.y, _posX.z, dx, dy, dz);
+            const floatv posYDistance = util::simd::dot(_posY.x, _posY.y, _posY.z, dx, dy, dz);
+            const floatv posZDistance = util::simd::dot(_posZ.x, _posZ.y, _posZ.z, dx, dy, dz);
+
+            const floatv posX = posXDistance - hx;
+            const floatv negX = -posXDistance - hx;
+            const floatv posY = posYDistance - hy;
+            const floatv negY = -posYDistance - hy;
+            const floatv posZ = posZDistance - hz;
+            const floatv negZ = -posZDistance - hz;
+
+            const floatv inside = (posX <= 0.0F) & (negX <= 0.0F) & (posY <= 0.0F) & (negY <= 0.0F) & (posZ <= 0.0F) & (negZ <= 0.0F);
+            const floatv c = min(min(-posX / f, min(-negX / f, min(-posY / f, min(-negY / f, min(-posZ / f, -negZ / f))))), 1.0F);
+            util::simd::select(inside, c, 0.0F).store(values + i);
+            volume_samplers_helpers::blendMaterials(values + i, 0, floatv::width, _material, materials ? materials + i : nullptr);
+        }
+
+        MaterialState unused;
+        for (; i < n; i++) {
+            values[i] = valueAt(glm::vec3(xs[i], ys[i], zs[i]), fuzziness, materials ? materials[i] : unused);
+        }
+    }
+
+    float distanceBound(const glm::vec3& p, float fuzziness) const override
+    {
+        // the value is 0 outside any of the prism's 6 planes, and 1 beyond fuzziness inside all of them;
+        // the largest plane distance changes no faster than the longest plane normal
+        const auto dir = p - _origin;
+        const auto d = glm::abs(glm::vec3(dot(_posX, dir), dot(_posY, dir), dot(_posZ, dir))) - _halfExtents;
+        const float outside = glm::max(d.x, glm::max(d.y, d.z));
+        const float normalLength = glm::max(length(_posX), glm::max(length(_posY), length(_posZ)));
+        if (outside > 0) {
+            return outside / normalLength;
+        }
+        return glm::max(-(fuzziness + 1e-5F) - outside, 0.0F) / normalLength;
+    }
+
+    ValueRange rangeOver(util::AABB bounds, float fuzziness) const override
+    {
+        using namespace volume_samplers_helpers;
+
+        // valueAt() is the least distance inside the 3 slabs bounding the prism, over
+        // fuzziness and clamped to 1; or 0 outside any of them
+        const float f = fuzziness + 1e-5F;
+        const glm::vec3 axes[3] = { _posX, _posY, _posZ };
+        float least = 1;
+        float most = 1;
+        for (int i = 0; i < 3; i++) {
+            const auto dist = absRange(projectedRange(bounds, _origin, axes[i]));
+            least = glm::min(least, (_halfExtents[i] - dist.y) / f);
+            most = glm::min(most, (_halfExtents[i] - dist.x) / f);
+        }
+
+        return ValueRange { glm::max(least, 0.0F), glm::max(most, 0.0F) };
+    }
+
     void setPosition(const glm::vec3& position)
     {
         _origin = position;
@@ -518,13 +801,15 @@ public:
         return _corners;
     }
 
-    void addTo(util::LineSegmentBuffer& lineBuffer, const glm::vec4& color) const
+    // Trace this prism's edges into a line buffer such as util::LineSegmentBuffer
+    template <class LineBuffer>
+    void addTo(LineBuffer& lineBuffer, const glm::vec4& color) const
     {
         auto corners = this->corners();
 
         // trace bottom
         {
-            using V = util::LineSegmentBuffer::vertex_type;
+            using V = typename LineBuffer::vertex_type;
             lineBuffer.add(V { corners[0], color }, V { corners[1], color });
             lineBuffer.add(V { corners[1], color }, V { corners[2], color });
             lineBuffer.add(V { corners[2], color }, V { corners[3], color });